@@ -1,21 +1,84 @@
 #!/usr/bin/env python3
 from __future__ import annotations
 
-from collections import Counter
-from datetime import datetime
+import base64
+import bisect
+from concurrent.futures import ThreadPoolExecutor
+from contextlib import contextmanager, nullcontext, redirect_stderr, redirect_stdout
+from datetime import date, datetime, timezone
+import fcntl
+import glob
+import hashlib
+import heapq
+import importlib.util
+import io
+import json
+import math
+import mmap
 import os
+import platform
+import random
 import re
+import signal
+import socket
+import struct
+import subprocess
 import sys
-from dataclasses import dataclass
+import tempfile
+import threading
+import time
+import zlib
+from collections import OrderedDict
+from dataclasses import astuple, dataclass, replace
+from functools import lru_cache
 from pathlib import Path
-from typing import Any
+from typing import IO, Any, Callable, Iterable, Iterator
+
+
+def lazy_import(name: str) -> Any:
+    # The module object is bound now but only executed on first attribute access,
+    # so commands that never reach FAISS or numpy (clean, --help, plain analyze
+    # tables) do not pay for importing them.
+    module = sys.modules.get(name)
+    if module is not None:
+        return module
+    spec = importlib.util.find_spec(name)
+    if spec is None or spec.loader is None:
+        raise ModuleNotFoundError(f"No module named '{name}'", name=name)
+    loader = importlib.util.LazyLoader(spec.loader)
+    spec.loader = loader
+    module = importlib.util.module_from_spec(spec)
+    sys.modules[name] = module
+    loader.exec_module(module)
+    return module
+
+
+faiss = lazy_import("faiss")
+np = lazy_import("numpy")
+yaml = lazy_import("yaml")
+
+
+def ensure_loaded(*modules: Any) -> None:
+    # Call before fanning out to threads: Python 3.11's LazyLoader does not guard
+    # a first attribute access made from several threads at once.
+    for module in modules:
+        getattr(module, "__spec__")
 
-import faiss
-import numpy as np
-import yaml
 
 DIM = 384
 MAX_K = 100
+# Recall asks the index for k * RECALL_OVERFETCH neighbours and doubles the
+# window only when filtered/blank records leave fewer than k usable hits.
+RECALL_OVERFETCH = 4
+# reindex embeds and inserts this many records per batch.
+REINDEX_CHUNK = 8192
+# Upper bound on vectors sampled to train IVF/PQ/SQ indexes.
+TRAIN_SAMPLE_MAX = 131072
+IVF_DEFAULT_NPROBE = 16
+FLAT_INDEX_SPEC = "Flat"
+# Filtered recalls with at most this many candidates skip HNSW and score the
+# candidate vectors exactly.
+EXACT_SCAN_MAX = 2048
 
 
 @dataclass
@@ -32,7 +95,17 @@ def literal_string_representer(dumper: yaml.Dumper, data: LiteralString) -> yaml
     return dumper.represent_scalar("tag:yaml.org,2002:str", str(data), style="|")
 
 
-yaml.SafeDumper.add_representer(LiteralString, literal_string_representer)
+_literal_registered = False
+
+
+def literal_yaml() -> Any:
+    # yaml with LiteralString dumped as a block scalar; registered on first dump so
+    # that importing this module does not load yaml.
+    global _literal_registered
+    if not _literal_registered:
+        yaml.SafeDumper.add_representer(LiteralString, literal_string_representer)
+        _literal_registered = True
+    return yaml
 
 
 def vlog(enabled: bool, msg: str) -> None:
@@ -40,11 +113,102 @@ def vlog(enabled: bool, msg: str) -> None:
         print(msg, file=sys.stderr)
 
 
+class Profiler:
+    # Per-command wall time by phase plus work counters. Phase time is summed per
+    # name (and across threads, for sharded fan-out); -v prints it as one summary
+    # line on stderr, --profile as one JSON object.
+    def __init__(self) -> None:
+        self.startup: float | None = None  # interpreter start -> main(); None when served
+        self.active = False
+        self._lock = threading.Lock()
+        self.reset()
+
+    def reset(self) -> None:
+        self.started = time.perf_counter()
+        self.phases: dict[str, float] = {}
+        self.counters: dict[str, int] = {}
+
+    def add_time(self, name: str, secs: float) -> None:
+        with self._lock:
+            self.phases[name] = self.phases.get(name, 0.0) + secs
+
+    @contextmanager
+    def phase(self, name: str) -> Iterator[None]:
+        started = time.perf_counter()
+        try:
+            yield
+        finally:
+            self.add_time(name, time.perf_counter() - started)
+
+    def count(self, name: str, n: int = 1) -> None:
+        with self._lock:
+            self.counters[name] = self.counters.get(name, 0) + int(n)
+
+    def report(self, command: str, rc: int) -> dict[str, Any]:
+        return {
+            "command": command,
+            "rc": rc,
+            "total_ms": round((time.perf_counter() - self.started) * 1000, 3),
+            "startup_ms": None if self.startup is None else round(self.startup * 1000, 3),
+            "phases_ms": {name: round(secs * 1000, 3) for name, secs in self.phases.items()},
+            "counters": dict(self.counters),
+        }
+
+
+PROFILE = Profiler()
+
+
+def process_age() -> float | None:
+    # Seconds since this process started, from /proc (Linux only; 10ms resolution).
+    try:
+        stat = Path("/proc/self/stat").read_text()
+        uptime = float(Path("/proc/uptime").read_text().split()[0])
+        start_ticks = int(stat[stat.rindex(")") + 2 :].split()[19])
+        return max(0.0, uptime - start_ticks / os.sysconf("SC_CLK_TCK"))
+    except (OSError, ValueError, IndexError):
+        return None
+
+
+def print_profile(report: dict[str, Any], as_json: bool) -> None:
+    if as_json:
+        print(json.dumps(report), file=sys.stderr)
+        return
+    head = f"Profile: {report['command']} {report['total_ms']:.1f}ms"
+    if report["startup_ms"] is not None:
+        head += f" (+{report['startup_ms']:.0f}ms startup)"
+    phases = ", ".join(f"{name} {ms:.1f}ms" for name, ms in report["phases_ms"].items())
+    counters = " ".join(f"{name}={n}" for name, n in report["counters"].items())
+    print(" | ".join(part for part in (head, phases, counters) if part), file=sys.stderr)
+
+
 def has_path_separator(s: str) -> bool:
     return "/" in s
 
 
-def build_db_paths(base: str, user_cwd: str) -> tuple[Path, Path]:
+@dataclass
+class DbPaths:
+    stem: Path
+    index: Path
+    yaml: Path
+    rec: Path
+    rix: Path
+    delta: Path
+    conf: Path
+    ivfdata: Path
+    midx: Path
+    bm25: Path
+    cols: Path
+    ecache: Path
+    tomb: Path
+    lock: Path
+    compact_lock: Path
+    sock: Path
+
+    def files(self) -> list[Path]:
+        return [self.index, self.yaml, self.rec, self.rix, self.delta, self.conf, self.ivfdata, self.midx, self.bm25, self.cols, self.ecache, self.tomb]
+
+
+def build_db_paths(base: str, user_cwd: str) -> DbPaths:
     if has_path_separator(base):
         if base.startswith("/"):
             prefix = Path(base)
@@ -52,9 +216,31 @@ def build_db_paths(base: str, user_cwd: str) -> tuple[Path, Path]:
             prefix = Path(user_cwd) / base
     else:
         prefix = Path(user_cwd) / base
-    return (
-        prefix.with_suffix(".memo"),
-        prefix.with_suffix(".yaml"),
+    # A dotted basename keeps the old with_suffix naming: "my.db" -> my.memo, my.yaml, ...
+    return db_paths_for_stem(prefix.with_suffix(""))
+
+
+def db_paths_for_stem(stem: Path) -> DbPaths:
+    def sibling(suffix: str) -> Path:
+        return stem.with_name(stem.name + suffix)
+
+    return DbPaths(
+        stem=stem,
+        index=sibling(".memo"),
+        yaml=sibling(".yaml"),
+        rec=sibling(".rec"),
+        rix=sibling(".rix"),
+        delta=sibling(".delta"),
+        conf=sibling(".conf"),
+        ivfdata=sibling(".ivfdata"),
+        midx=sibling(".midx"),
+        bm25=sibling(".bm25"),
+        cols=sibling(".cols"),
+        ecache=sibling(".ecache"),
+        tomb=sibling(".tomb"),
+        lock=sibling(".lock"),
+        compact_lock=sibling(".compact.lock"),
+        sock=sibling(".sock"),
     )
 
 
@@ -63,42 +249,228 @@ def ensure_parent_dir(file_path: Path) -> None:
     parent.mkdir(parents=True, exist_ok=True)
 
 
+# Single writer, many readers. Writers (save, reindex, clean) hold an exclusive
+# flock on <base>.lock for the whole command; readers never take it except to
+# opportunistically persist a rebuilt sidecar, and then only without waiting.
+# Files rewritten wholesale go through atomic_write, so a reader sees either the
+# old or the new file; appends are ordered so the old view stays valid.
+# <base>.lock is never removed: a waiter would otherwise lock a dead inode.
+HELD_LOCKS = threading.local()  # .paths: locks this thread holds; other threads must flock for themselves
+
+
+def held_locks() -> set[Path]:
+    if not hasattr(HELD_LOCKS, "paths"):
+        HELD_LOCKS.paths = set()
+    return HELD_LOCKS.paths
+
+
+@contextmanager
+def file_lock(path: Path, blocking: bool = True) -> Iterator[bool]:
+    held = held_locks()
+    if path in held:
+        yield True
+        return
+    ensure_parent_dir(path)
+    with path.open("a") as fh:
+        try:
+            fcntl.flock(fh, fcntl.LOCK_EX if blocking else fcntl.LOCK_EX | fcntl.LOCK_NB)
+        except BlockingIOError:
+            yield False
+            return
+        held.add(path)
+        try:
+            yield True
+        finally:
+            held.discard(path)
+            fcntl.flock(fh, fcntl.LOCK_UN)
+
+
+@contextmanager
+def db_lock(paths: DbPaths, blocking: bool = True) -> Iterator[bool]:
+    with file_lock(paths.lock, blocking) as held:
+        yield held
+
+
+@contextmanager
+def atomic_write(path: Path) -> Iterator[IO[bytes]]:
+    ensure_parent_dir(path)
+    tmp = path.with_name(f"{path.name}.tmp{os.getpid()}")
+    try:
+        with tmp.open("wb") as fh:
+            yield fh
+        os.replace(tmp, path)
+    finally:
+        tmp.unlink(missing_ok=True)
+
+
+# Per-database settings, stored as JSON in <base>.conf next to the index.
+#   index: FAISS index_factory string for the vectors (wrapped in IDMap2)
+#   indexed_keys: metadata keys with secondary indexes in <base>.midx
+#   flat_max: stores with fewer live vectors use an exact flat index instead of `index`
+#   hnsw_m: HNSW graph degree, replacing the M of a leading HNSW in `index` (null keeps the spec's)
+#   ef_construction, ef_search: HNSW build effort and default query effort, stored in the index
+#   quantize: vector codec replacing the storage part of `index` (see QUANTIZE_CODECS;
+#     null keeps the spec's)
+#   rerank: re-score the top k * overfetch hits of a quantized index with float vectors
+#   embedder: "hash" or "st:<model>", see get_embedder
+#   compact_ratio: tombstoned share of stored vectors that starts a background compaction
+#     (null disables it)
+#   shards, shard_key: see shard_paths; the settings above are copied into each shard
+DEFAULT_DB_CONFIG: dict[str, Any] = {
+    "index": "HNSW32,Flat",
+    "flat_max": 10000,
+    "indexed_keys": ["source", "tags", "ts"],
+    "shards": 1,
+    "shard_key": None,
+    "hnsw_m": None,
+    "ef_construction": 200,
+    "ef_search": 64,
+    "quantize": None,
+    "rerank": True,
+    "embedder": "hash",
+    "compact_ratio": 0.2,
+}
+SHARD_CONFIG_KEYS = ("shards", "shard_key")
+
+
+# Bytes per 384-dim vector: float 1536, int8 384, int4 192, pq 48 (as small as one bit per
+# dimension). pq needs a training pass, which reindex runs on the stored vectors.
+QUANTIZE_CODECS = {"int8": "SQ8", "int4": "SQ4", "pq": f"PQ{DIM // 8}"}
+
+
+def index_spec_for(config: dict[str, Any], count: int) -> str:
+    if count < config["flat_max"]:
+        return FLAT_INDEX_SPEC
+    spec = config["index"]
+    if config["hnsw_m"] is not None:
+        # Only a top-level HNSW graph: in e.g. IVF4096_HNSW32,PQ48 the HNSW is the coarse quantizer.
+        if not re.match(r"HNSW\d*(?=$|[_,])", spec):
+            raise ValueError(f"hnsw_m is set but index spec '{spec}' does not start with HNSW")
+        spec = re.sub(r"^HNSW\d*", f"HNSW{int(config['hnsw_m'])}", spec)
+    if config["quantize"] is not None:
+        if config["quantize"] not in QUANTIZE_CODECS:
+            raise ValueError(f"quantize must be one of {', '.join(QUANTIZE_CODECS)} or null")
+        parts = spec.split(",")
+        if len(parts) == 1 or re.fullmatch(r"(HNSW|IVF)\d*(_HNSW\d*)?", parts[-1]):
+            parts.append(QUANTIZE_CODECS[config["quantize"]])
+        else:
+            parts[-1] = QUANTIZE_CODECS[config["quantize"]]
+        spec = ",".join(parts)
+    return spec
+
+
+def load_db_config(paths: DbPaths) -> dict[str, Any]:
+    config = dict(DEFAULT_DB_CONFIG)
+    try:
+        stored = json.loads(paths.conf.read_text(encoding="utf-8"))
+    except FileNotFoundError:
+        return config
+    if not isinstance(stored, dict):
+        raise ValueError(f"{paths.conf.name} must contain a JSON object")
+    config.update(stored)
+    return config
+
+
+def save_db_config(paths: DbPaths, config: dict[str, Any]) -> None:
+    with atomic_write(paths.conf) as fh:
+        fh.write((json.dumps(config, indent=2, sort_keys=True) + "\n").encode("utf-8"))
+
+
+# With shards > 1, <base> only holds <base>.conf and its records live in independent
+# databases <base>_s0 .. <base>_s{N-1}. Global id = local id * N + shard. With a
+# shard_key, new records go to crc32(str(metadata[shard_key])) % N (records without
+# the key go to the smallest shard), so an equality filter on the key pins one shard;
+# otherwise new records fill the smallest shard.
+def shard_paths(paths: DbPaths, config: dict[str, Any]) -> list[DbPaths]:
+    if config["shards"] <= 1:
+        return [paths]
+    return [db_paths_for_stem(paths.stem.with_name(f"{paths.stem.name}_s{i}")) for i in range(config["shards"])]
+
+
+def shard_for_value(value: Any, shards: int) -> int:
+    return zlib.crc32(str(value).encode("utf-8")) % shards
+
+
+def filter_shards(filt: dict[str, Any], shard_key: str | None, shards: int) -> set[int] | None:
+    # Shards that can hold a match (None: any). Only bare equality on the key narrows.
+    if shard_key is None:
+        return None
+    allowed: set[int] | None = None
+    for key, cond in filt.items():
+        if key == shard_key and not isinstance(cond, dict):
+            allowed = intersect_ids(allowed, {shard_for_value(cond, shards)})
+        elif key == "$and" and isinstance(cond, list):
+            for part in cond:
+                if isinstance(part, dict):
+                    allowed = intersect_ids(allowed, filter_shards(part, shard_key, shards))
+    return allowed
+
+
+# Set by `memo serve`: loaded record stores and indexes keyed by file, reused
+# for as long as the files they were loaded from are unchanged.
+WARM_CACHE: dict[str, tuple[Any, Any]] | None = None
+
+
+def file_stamp(*files: Path) -> tuple[tuple[int, int, int] | None, ...]:
+    out: list[tuple[int, int, int] | None] = []
+    for path in files:
+        try:
+            st = path.stat()
+        except FileNotFoundError:
+            out.append(None)
+            continue
+        out.append((st.st_ino, st.st_size, st.st_mtime_ns))
+    return tuple(out)
+
+
+def warm(key: str, stamp: Any, load: Callable[[], Any]) -> Any:
+    if WARM_CACHE is None:
+        return load()
+    cached = WARM_CACHE.get(key)
+    if cached is not None and cached[0] == stamp:
+        return cached[1]
+    value = load()
+    WARM_CACHE[key] = (stamp, value)
+    return value
+
+
 def load_yaml_tables(path: Path) -> tuple[list[str], list[dict[str, Any] | None]]:
     if not path.exists():
         return [], []
 
-    docs = list(yaml.safe_load_all(path.read_text(encoding="utf-8")))
-    parsed_docs = [doc for doc in docs if doc is not None]
-    if not parsed_docs:
-        return [], []
-
-    ids_seen: set[int] = set()
     max_id = -1
     normalized: list[dict[str, Any]] = []
 
-    for doc in parsed_docs:
-        if not isinstance(doc, dict):
-            raise ValueError("database YAML entries must be mappings")
-        if "id" not in doc or "body" not in doc:
-            raise ValueError("database YAML entries require 'id' and 'body'")
-
-        doc_id = doc["id"]
-        body = doc["body"]
-        metadata = doc.get("metadata")
-
-        if not isinstance(doc_id, int) or doc_id < 0:
-            raise ValueError("database YAML entry 'id' must be a non-negative integer")
-        if doc_id in ids_seen:
-            raise ValueError(f"database YAML has duplicate id {doc_id}")
-        if not isinstance(body, str):
-            raise ValueError(f"database YAML entry body for id {doc_id} must be a string")
-        if metadata is not None and not isinstance(metadata, dict):
-            raise ValueError(f"database YAML entry metadata for id {doc_id} must be a mapping")
-
-        ids_seen.add(doc_id)
-        max_id = max(max_id, doc_id)
-        normalized.append({"id": doc_id, "body": body, "metadata": metadata})
+    # Documents are consumed one at a time from the file stream, with libyaml's
+    # loader when PyYAML was built with it.
+    loader = getattr(yaml, "CSafeLoader", yaml.SafeLoader)
+    with path.open("r", encoding="utf-8") as fh:
+        for doc in yaml.load_all(fh, Loader=loader):
+            if doc is None:
+                continue
+            if not isinstance(doc, dict):
+                raise ValueError("database YAML entries must be mappings")
+            if "id" not in doc or "body" not in doc:
+                raise ValueError("database YAML entries require 'id' and 'body'")
+
+            doc_id = doc["id"]
+            body = doc["body"]
+            metadata = doc.get("metadata")
+
+            if not isinstance(doc_id, int) or doc_id < 0:
+                raise ValueError("database YAML entry 'id' must be a non-negative integer")
+            if not isinstance(body, str):
+                raise ValueError(f"database YAML entry body for id {doc_id} must be a string")
+            if metadata is not None and not isinstance(metadata, dict):
+                raise ValueError(f"database YAML entry metadata for id {doc_id} must be a mapping")
+
+            max_id = max(max_id, doc_id)
+            normalized.append({"id": doc_id, "body": body, "metadata": metadata})
+
+    if not normalized:
+        return [], []
 
+    # Overwrites are appended as a later document with the same id; the last one wins.
     texts = [""] * (max_id + 1)
     metas: list[dict[str, Any] | None] = [None] * (max_id + 1)
     for rec in normalized:
@@ -109,30 +481,400 @@ def load_yaml_tables(path: Path) -> tuple[list[str], list[dict[str, Any] | None]
     return texts, metas
 
 
-def save_yaml_tables(path: Path, texts: list[str], metas: list[dict[str, Any] | None]) -> None:
+def dump_yaml_records(records: list[tuple[int, str, dict[str, Any] | None]]) -> str:
     docs: list[dict[str, Any]] = []
-    for doc_id, body in enumerate(texts):
+    for doc_id, body, metadata in records:
         rec: dict[str, Any] = {
             "id": doc_id,
-            "metadata": metas[doc_id] if doc_id < len(metas) and metas[doc_id] is not None else {},
+            "metadata": metadata if metadata is not None else {},
             "body": LiteralString(body),
         }
         docs.append(rec)
 
-    payload = yaml.safe_dump_all(
+    return literal_yaml().safe_dump_all(
         docs,
         explicit_start=True,
         sort_keys=False,
         allow_unicode=True,
     )
-    path.write_text(payload, encoding="utf-8")
 
 
-def normalize(v: np.ndarray) -> np.ndarray:
-    n = np.linalg.norm(v)
-    if n <= 1e-8:
-        return np.zeros_like(v)
-    return v / n
+def save_yaml_tables(path: Path, texts: list[str], metas: list[dict[str, Any] | None]) -> None:
+    records = [(doc_id, body, metas[doc_id] if doc_id < len(metas) else None) for doc_id, body in enumerate(texts)]
+    with atomic_write(path) as fh:
+        fh.write(dump_yaml_records(records).encode("utf-8"))
+
+
+def append_yaml_records(path: Path, records: list[tuple[int, str, dict[str, Any] | None]]) -> None:
+    payload = dump_yaml_records(records)
+    with path.open("a+b") as fh:
+        if fh.tell() > 0:
+            fh.seek(-1, os.SEEK_END)
+            if fh.read(1) != b"\n":
+                fh.write(b"\n")
+        fh.write(payload.encode("utf-8"))
+
+
+# Sidecars hold plain data (JSON, or numpy arrays), never pickles, so opening a
+# database cannot run code from it. YAML values JSON lacks (timestamps, dates,
+# binary, sets, non-string keys) are written as one-key tag objects; a mapping
+# that would read back as a tag is itself written as a $map.
+DATA_TAGS = ("$datetime", "$date", "$bytes", "$set", "$map")
+
+
+def encode_data(value: Any) -> Any:
+    if value is None or isinstance(value, (bool, int, float, str)):
+        return value
+    if isinstance(value, datetime):
+        return {"$datetime": value.isoformat()}
+    if isinstance(value, date):
+        return {"$date": value.isoformat()}
+    if isinstance(value, bytes):
+        return {"$bytes": base64.b64encode(value).decode("ascii")}
+    if isinstance(value, (set, frozenset)):
+        return {"$set": [encode_data(v) for v in value]}
+    if isinstance(value, (list, tuple)):
+        return [encode_data(v) for v in value]
+    if isinstance(value, dict):
+        if all(isinstance(k, str) for k in value) and not (len(value) == 1 and next(iter(value)) in DATA_TAGS):
+            return {k: encode_data(v) for k, v in value.items()}
+        return {"$map": [[encode_data(k), encode_data(v)] for k, v in value.items()]}
+    raise ValueError(f"cannot store a value of type {type(value).__name__}")
+
+
+def decode_tag(obj: dict[str, Any]) -> Any:
+    # json object_hook: inner objects are already decoded when their parent arrives.
+    if len(obj) != 1:
+        return obj
+    tag, payload = next(iter(obj.items()))
+    if tag == "$datetime":
+        return datetime.fromisoformat(payload)
+    if tag == "$date":
+        return date.fromisoformat(payload)
+    if tag == "$bytes":
+        return base64.b64decode(payload)
+    if tag == "$set":
+        return set(payload)
+    if tag == "$map":
+        return {k: v for k, v in payload}
+    return obj
+
+
+def dump_data(value: Any) -> bytes:
+    return json.dumps(encode_data(value), ensure_ascii=False, separators=(",", ":")).encode("utf-8")
+
+
+def load_data(raw: bytes | bytearray | memoryview) -> Any:
+    return json.loads(bytes(raw), object_hook=decode_tag)
+
+
+# Binary record sidecar, derived from <base>.yaml:
+#   <base>.rec  heap of utf-8 bodies and JSON metadata (dump_data), addressed by offset
+#   <base>.rix  fixed-size header + one row per id pointing into the heap
+# Both are memory-mapped, so reading a record only touches its own bytes.
+# The header records the YAML size/mtime it was built from; any mismatch
+# (hand edits, missing sidecar) regenerates it from YAML.
+# Overwrites append a new heap entry; the .rix is rewritten with the row repointed.
+RIX_MAGIC = b"MEMORIX\0"
+RIX_VERSION = 4
+# magic, version, reserved, count, yaml_size, yaml_mtime_ns, generation, heap_id
+RIX_HEADER = struct.Struct("<8sIIQQQQQ16x")
+RIX_ROW = struct.Struct("<QIIII")  # heap offset, body length, metadata length, flags, vector version
+REC_MAGIC = b"MEMOREC\0"
+# A rewrite replaces .rec then .rix; the shared random heap_id lets a reader that
+# caught one old and one new file notice and retry. Version 1 had no heap_id.
+REC_HEADER = struct.Struct("<8sQ")  # magic, heap_id
+
+REC_BLANK = 1 << 0
+REC_DELETED = 1 << 1  # soft-deleted (see is_deleted_record), decided once when the row is written; since version 3
+
+# FAISS labels carry the record's vector version above the id bits. An
+# overwrite bumps the version and adds a new vector; the old label stays in
+# HNSW (which cannot delete) as a tombstone until compaction or reindex drops it.
+LABEL_VERSION_SHIFT = 40
+LABEL_ID_MASK = (1 << LABEL_VERSION_SHIFT) - 1
+
+
+def rix_row_dtype() -> np.dtype:
+    return np.dtype([("off", "<u8"), ("body_len", "<u4"), ("meta_len", "<u4"), ("flags", "<u4"), ("version", "<u4")])
+
+
+def make_label(doc_id: int, version: int) -> int:
+    return doc_id | (version << LABEL_VERSION_SHIFT)
+
+
+def label_doc_id(label: int) -> int:
+    return label & LABEL_ID_MASK
+
+
+def yaml_stamp(path: Path) -> tuple[int, int]:
+    try:
+        st = path.stat()
+    except FileNotFoundError:
+        return 0, 0
+    return st.st_size, st.st_mtime_ns
+
+
+def map_file(path: Path) -> mmap.mmap | bytes:
+    with path.open("rb") as fh:
+        if os.fstat(fh.fileno()).st_size == 0:
+            return b""
+        return mmap.mmap(fh.fileno(), 0, access=mmap.ACCESS_READ)
+
+
+class RecordStore:
+    def __init__(self, rix: mmap.mmap | bytes, rec: mmap.mmap | bytes) -> None:
+        self._rix = rix
+        self._rec = rec
+        magic, version, _, count, yaml_size, yaml_mtime_ns, generation, heap_id = RIX_HEADER.unpack_from(rix, 0)
+        if magic != RIX_MAGIC or version not in (1, 2, 3, RIX_VERSION):
+            raise ValueError("unsupported record index format")
+        if len(rix) < RIX_HEADER.size + count * RIX_ROW.size or rec[: len(REC_MAGIC)] != REC_MAGIC:
+            raise ValueError("truncated record store")
+        if version >= 2 and REC_HEADER.unpack_from(rec, 0)[1] != heap_id:
+            raise ValueError("record heap does not match record index")
+        self.count = int(count)
+        self.yaml_stamp = (int(yaml_size), int(yaml_mtime_ns))
+        self.generation = int(generation)
+        self.heap_id = int(heap_id)
+        # Older stores (before version 4 metadata was pickled) are never decoded: only their
+        # vector versions are carried over, and they are always regenerated.
+        self.legacy = version != RIX_VERSION
+
+    @classmethod
+    def open(cls, paths: DbPaths) -> RecordStore:
+        return cls(map_file(paths.rix), map_file(paths.rec))
+
+    @classmethod
+    def empty(cls) -> RecordStore:
+        return cls(RIX_HEADER.pack(RIX_MAGIC, RIX_VERSION, 0, 0, 0, 0, 0, 0), REC_HEADER.pack(REC_MAGIC, 0))
+
+    def __len__(self) -> int:
+        return self.count
+
+    def _row(self, doc_id: int) -> tuple[int, int, int, int, int]:
+        return RIX_ROW.unpack_from(self._rix, RIX_HEADER.size + doc_id * RIX_ROW.size)
+
+    def flags(self, doc_id: int) -> int:
+        if doc_id < 0 or doc_id >= self.count:
+            return 0
+        return self._row(doc_id)[3]
+
+    def is_blank(self, doc_id: int) -> bool:
+        if doc_id < 0 or doc_id >= self.count:
+            return True
+        return bool(self._row(doc_id)[3] & REC_BLANK)
+
+    def is_deleted(self, doc_id: int) -> bool:
+        return bool(self.flags(doc_id) & REC_DELETED)
+
+    def flag_array(self) -> np.ndarray:
+        # Flags of every row at once, read straight from the mapped .rix.
+        rows = np.frombuffer(self._rix, dtype=rix_row_dtype(), count=self.count, offset=RIX_HEADER.size)
+        return rows["flags"].copy()
+
+    def offset_array(self) -> np.ndarray:
+        # Heap offset of every row; a row moves to a new offset whenever it is overwritten.
+        rows = np.frombuffer(self._rix, dtype=rix_row_dtype(), count=self.count, offset=RIX_HEADER.size)
+        return rows["off"].copy()
+
+    def version_array(self) -> np.ndarray:
+        rows = np.frombuffer(self._rix, dtype=rix_row_dtype(), count=self.count, offset=RIX_HEADER.size)
+        return rows["version"].copy()
+
+    def vec_version(self, doc_id: int) -> int:
+        if doc_id < 0 or doc_id >= self.count:
+            return 0
+        return self._row(doc_id)[4]
+
+    def label(self, doc_id: int) -> int:
+        return make_label(doc_id, self.vec_version(doc_id))
+
+    def body(self, doc_id: int) -> str:
+        if doc_id < 0 or doc_id >= self.count:
+            return ""
+        off, body_len, _, _, _ = self._row(doc_id)
+        return bytes(self._rec[off : off + body_len]).decode("utf-8")
+
+    def metadata(self, doc_id: int) -> dict[str, Any] | None:
+        if doc_id < 0 or doc_id >= self.count:
+            return None
+        off, body_len, meta_len, _, _ = self._row(doc_id)
+        if meta_len == 0:
+            return None
+        start = off + body_len
+        return load_data(self._rec[start : start + meta_len])
+
+    def tables(self) -> tuple[list[str], list[dict[str, Any] | None]]:
+        texts = [self.body(i) for i in range(self.count)]
+        metas = [self.metadata(i) for i in range(self.count)]
+        return texts, metas
+
+
+HeapRecord = tuple[str, dict[str, Any] | None, int]  # body, metadata, vector version
+
+
+def write_heap_records(heap: Any, off: int, records: list[HeapRecord]) -> list[bytes]:
+    rows: list[bytes] = []
+    for body, metadata, version in records:
+        body_bytes = body.encode("utf-8")
+        meta_bytes = dump_data(metadata) if metadata is not None else b""
+        flags = REC_BLANK if is_blank_body(body) else 0
+        if is_deleted_record(metadata, body):
+            flags |= REC_DELETED
+        heap.write(body_bytes)
+        heap.write(meta_bytes)
+        rows.append(RIX_ROW.pack(off, len(body_bytes), len(meta_bytes), flags, version))
+        off += len(body_bytes) + len(meta_bytes)
+    return rows
+
+
+def pack_record_store(
+    heap: IO[bytes],
+    texts: list[str],
+    metas: list[dict[str, Any] | None],
+    generation: int,
+    versions: list[int] | None,
+    stamp: tuple[int, int],
+) -> bytes:
+    # Streams the heap into `heap` and returns the matching .rix contents.
+    heap_id = int.from_bytes(os.urandom(8), "little")
+    records = [
+        (
+            body,
+            metas[doc_id] if doc_id < len(metas) else None,
+            versions[doc_id] if versions is not None and doc_id < len(versions) else 0,
+        )
+        for doc_id, body in enumerate(texts)
+    ]
+    heap.write(REC_HEADER.pack(REC_MAGIC, heap_id))
+    rows = write_heap_records(heap, REC_HEADER.size, records)
+    header = RIX_HEADER.pack(RIX_MAGIC, RIX_VERSION, 0, len(texts), stamp[0], stamp[1], generation, heap_id)
+    return header + b"".join(rows)
+
+
+def write_record_store(
+    paths: DbPaths,
+    texts: list[str],
+    metas: list[dict[str, Any] | None],
+    generation: int,
+    versions: list[int] | None = None,
+) -> None:
+    with atomic_write(paths.rec) as heap:
+        rix = pack_record_store(heap, texts, metas, generation, versions, yaml_stamp(paths.yaml))
+    with atomic_write(paths.rix) as fh:
+        fh.write(rix)
+
+
+def update_record_store(
+    paths: DbPaths,
+    store: RecordStore,
+    appended: list[HeapRecord],
+    replaced: dict[int, HeapRecord],
+) -> None:
+    # Heap bytes are appended first; the .rix is then written whole under a temp
+    # name and renamed over the old one, so a reader maps either the old rows or
+    # the new ones and never a row that is half rewritten.
+    replaced_ids = sorted(replaced)
+    with paths.rec.open("ab") as heap:
+        off = heap.tell()
+        new_rows = write_heap_records(heap, off, appended)
+        off = heap.tell()
+        replaced_rows = write_heap_records(heap, off, [replaced[doc_id] for doc_id in replaced_ids])
+
+    count = store.count + len(appended)
+    yaml_size, yaml_mtime_ns = yaml_stamp(paths.yaml)
+    header = RIX_HEADER.pack(
+        RIX_MAGIC, RIX_VERSION, 0, count, yaml_size, yaml_mtime_ns, store.generation + 1, store.heap_id
+    )
+    rix = bytearray(store._rix[: RIX_HEADER.size + store.count * RIX_ROW.size])
+    rix[: RIX_HEADER.size] = header
+    for doc_id, row in zip(replaced_ids, replaced_rows):
+        pos = RIX_HEADER.size + doc_id * RIX_ROW.size
+        rix[pos : pos + RIX_ROW.size] = row
+    rix += b"".join(new_rows)
+    with atomic_write(paths.rix) as fh:
+        fh.write(rix)
+
+
+def read_generation(paths: DbPaths) -> int:
+    try:
+        with paths.rix.open("rb") as fh:
+            magic, version, _, _, _, _, generation, _ = RIX_HEADER.unpack(fh.read(RIX_HEADER.size))
+    except (OSError, struct.error):
+        return 0
+    return int(generation) if magic == RIX_MAGIC else 0
+
+
+def open_record_store(paths: DbPaths, verbose: bool) -> RecordStore:
+    stamp = file_stamp(paths.yaml, paths.rix, paths.rec)
+    return warm(f"store:{paths.rix}", stamp, lambda: load_record_store(paths, verbose))
+
+
+def try_open_record_store(paths: DbPaths, verbose: bool) -> RecordStore | None:
+    if not (paths.rix.exists() and paths.rec.exists()):
+        return None
+    for attempt in range(3):
+        try:
+            return RecordStore.open(paths)
+        except (ValueError, struct.error, OSError) as e:
+            # A mismatched heap usually means a rewrite landed between the two opens.
+            vlog(verbose, f"Ignoring record store {paths.rix.name}: {e}")
+            time.sleep(0.01 * attempt)
+    return None
+
+
+def load_record_store(paths: DbPaths, verbose: bool) -> RecordStore:
+    if not paths.yaml.exists():
+        return RecordStore.empty()
+
+    store = try_open_record_store(paths, verbose)
+    if store is not None and not store.legacy and store.yaml_stamp == yaml_stamp(paths.yaml):
+        return store
+
+    with db_lock(paths, blocking=False) as locked:
+        if not locked:
+            # A writer is mid-save: its appended YAML is ahead of the sidecar, which is
+            # still a consistent (older) view. Without any sidecar, build one in memory.
+            if store is not None and not store.legacy:
+                vlog(verbose, f"{paths.rix.name} is being updated; reading the current version")
+                return store
+            vlog(verbose, f"Reading {paths.yaml.name} into memory while a writer holds {paths.lock.name}")
+            texts, metas = load_yaml_tables(paths.yaml)
+            heap = io.BytesIO()
+            rix = pack_record_store(heap, texts, metas, 0, None, yaml_stamp(paths.yaml))
+            return RecordStore(rix, heap.getvalue())
+
+        store = try_open_record_store(paths, verbose)
+        if store is not None and not store.legacy and store.yaml_stamp == yaml_stamp(paths.yaml):
+            return store
+        previous_generation = 0
+        versions: list[int] | None = None
+        if store is not None:
+            previous_generation = store.generation
+            # Vector versions are not in the YAML; keep them so existing labels stay live.
+            versions = [store.vec_version(i) for i in range(store.count)]
+
+        vlog(verbose, f"Regenerating record store from {paths.yaml.name}")
+        texts, metas = load_yaml_tables(paths.yaml)
+        write_record_store(paths, texts, metas, previous_generation + 1, versions)
+        return RecordStore.open(paths)
+
+
+def read_live_records(paths: DbPaths, verbose: bool) -> tuple[list[tuple[int, str, dict[str, Any] | None]], int]:
+    # Non-blank, non-deleted records in id order, plus the number of ids. A sidecar that
+    # matches <base>.yaml answers from its row flags; otherwise the YAML is parsed.
+    store = try_open_record_store(paths, verbose) if paths.yaml.exists() else None
+    if store is not None and not store.legacy and store.yaml_stamp == yaml_stamp(paths.yaml):
+        live = np.flatnonzero((store.flag_array() & (REC_BLANK | REC_DELETED)) == 0).tolist()
+        return [(doc_id, store.body(doc_id), store.metadata(doc_id)) for doc_id in live], store.count
+    texts, metas = load_yaml_tables(paths.yaml)
+    records = []
+    for doc_id, text in enumerate(texts):
+        metadata = metas[doc_id] if doc_id < len(metas) else None
+        if not is_blank_body(text) and not is_deleted_record(metadata, text):
+            records.append((doc_id, text, metadata))
+    return records, len(texts)
 
 
 def normalize_whitespace(text: str) -> str:
@@ -146,7 +888,9 @@ def is_blank_body(text: str | None) -> bool:
 def is_deleted_record(metadata: dict[str, Any] | None, body: str | None) -> bool:
     if isinstance(metadata, dict) and bool(metadata.get("deleted")):
         return True
-    if body is None:
+    # Only a body that parses to a mapping with a truthy `deleted` key counts, so bodies
+    # without the word are settled without a YAML parse.
+    if body is None or "deleted" not in body:
         return False
     try:
         parsed = yaml.safe_load(body)
@@ -155,16 +899,226 @@ def is_deleted_record(metadata: dict[str, Any] | None, body: str | None) -> bool
     return isinstance(parsed, dict) and bool(parsed.get("deleted"))
 
 
-def embed_text_hash(text: str, dim: int = DIM) -> np.ndarray:
-    normalized = normalize_whitespace(text)
-    tokens = re.findall(r"[a-zA-Z0-9_]+", normalized.lower())
-    vec = np.zeros((dim,), dtype=np.float32)
-    for token in tokens:
-        h = hash(token)
-        idx = abs(h) % dim
-        sign = 1.0 if (h & 1) else -1.0
-        vec[idx] += sign
-    return normalize(vec).astype(np.float32)
+TOKEN_RE = re.compile(r"[a-zA-Z0-9_]+")
+
+# (token, dim) -> signed bucket (bucket * 2 + sign bit), shared across calls and
+# bounded so a long-running memo serve does not grow it with every new token.
+TOKEN_SLOT_CACHE = 1 << 18
+
+
+@lru_cache(maxsize=TOKEN_SLOT_CACHE)
+def token_slot(token: str, dim: int) -> int:
+    # crc32 is stable across processes, unlike the salted builtin hash().
+    h = zlib.crc32(token.encode("utf-8"))
+    return (h % dim) * 2 + (h >> 31)
+
+
+def embed_texts(texts: list[str], dim: int = DIM) -> np.ndarray:
+    # Signed feature hashing over a batch: bucket counts for every document are
+    # accumulated with one bincount, then rows are L2-normalized together.
+    rows: list[int] = []
+    slots: list[int] = []
+    for row, text in enumerate(texts):
+        doc_slots = [token_slot(token, dim) for token in TOKEN_RE.findall(text.lower())]
+        slots.extend(doc_slots)
+        rows.extend([row] * len(doc_slots))
+
+    n = len(texts)
+    if not slots:
+        return np.zeros((n, dim), dtype=np.float32)
+    slot_arr = np.array(slots, dtype=np.int64)
+    flat = np.array(rows, dtype=np.int64) * dim + (slot_arr >> 1)
+    signs = np.where(slot_arr & 1, 1.0, -1.0)
+    mat = np.bincount(flat, weights=signs, minlength=n * dim).reshape(n, dim)
+    norms = np.linalg.norm(mat, axis=1, keepdims=True)
+    norms[norms <= 1e-8] = 1.0
+    return (mat / norms).astype(np.float32)
+
+
+# Embedders turn text into DIM-wide float32 rows; which one a database uses is the
+# "embedder" entry of <base>.conf ("hash", or "st:<model>" for a sentence-transformers
+# model). Changing it needs a reindex, since stored vectors are not comparable.
+EMBED_BATCH = 64
+
+
+class Embedder:
+    # The built-in feature hashing: cheap enough that caching it would not pay off.
+    name = "hash"
+    cacheable = False
+
+    def embed(self, texts: list[str]) -> np.ndarray:
+        PROFILE.count("texts_embedded", len(texts))
+        if not texts:
+            return np.zeros((0, DIM), dtype=np.float32)
+        return self.encode(texts)
+
+    def encode(self, texts: list[str]) -> np.ndarray:
+        return embed_texts(texts)
+
+
+class SentenceTransformerEmbedder(Embedder):
+    # Local transformer model (pip install 'memo[st]'), e.g. st:sentence-transformers/all-MiniLM-L6-v2.
+    # Inputs are encoded in EMBED_BATCH batches; torch runs each batch on all cores.
+    cacheable = True
+
+    def __init__(self, model: str) -> None:
+        try:
+            from sentence_transformers import SentenceTransformer
+        except ImportError as e:
+            raise ValueError(f"embedder 'st:{model}' needs the sentence-transformers package: {e}") from e
+        self.name = f"st:{model}"
+        self.model = SentenceTransformer(model, device="cpu")
+        dim = self.model.get_sentence_embedding_dimension()
+        if dim != DIM:
+            raise ValueError(f"embedder 'st:{model}' produces {dim}-dim vectors, expected {DIM}")
+
+    def encode(self, texts: list[str]) -> np.ndarray:
+        vecs = self.model.encode(
+            texts,
+            batch_size=EMBED_BATCH,
+            convert_to_numpy=True,
+            normalize_embeddings=True,
+            show_progress_bar=False,
+        )
+        return np.ascontiguousarray(vecs, dtype=np.float32)
+
+
+# Loaded models stay resident for the life of the process (memo serve reuses them).
+_embedders: dict[str, Embedder] = {}
+
+
+def get_embedder(name: str) -> Embedder:
+    embedder = _embedders.get(name)
+    if embedder is not None:
+        return embedder
+    if name == "hash":
+        embedder = Embedder()
+    elif name.startswith("st:") and name[3:].strip():
+        embedder = SentenceTransformerEmbedder(name[3:].strip())
+    else:
+        raise ValueError(f"unknown embedder '{name}' (expected 'hash' or 'st:<model>')")
+    _embedders[name] = embedder
+    return embedder
+
+
+# <base>.ecache maps a content hash (embedder name + text) to its vector, so reindex
+# and overwrites only re-run an expensive embedder on text that changed. It holds a
+# 16-byte header (ECACHE_MAGIC, sorted row count n), the high and low key halves of n
+# sorted rows as two u8 arrays, their n vectors, and then a tail of unsorted
+# ecache_dtype rows appended by saves. Lookups binary-search the mapped key halves and
+# read only the vectors they hit. Once the tail reaches ECACHE_TAIL_ROWS, a save sorts
+# it in; reindex rewrites the file with just the live records. Only used for cacheable
+# embedders.
+ECACHE_MAGIC = b"memoec1\0"
+ECACHE_TAIL_ROWS = 4096
+KEY_HALF_MASK = (1 << 64) - 1
+
+
+def ecache_dtype() -> np.dtype:
+    return np.dtype([("hi", "<u8"), ("lo", "<u8"), ("vec", "<f4", (DIM,))])
+
+
+class EmbedCache:
+    def __init__(self, path: Path, embedder: Embedder) -> None:
+        self.path = path
+        self.embedder = embedder
+        self.hi = np.zeros((0,), dtype="<u8")
+        self.lo = self.hi
+        self.vecs = np.zeros((0, DIM), dtype="<f4")
+        self.tail: dict[int, np.ndarray] = {}
+        self.sorted_layout = False  # False: missing, or an older unsorted file the next append replaces
+        if embedder.cacheable:
+            self._open()
+        self.new: dict[int, np.ndarray] = {}
+
+    def _open(self) -> None:
+        try:
+            with self.path.open("rb") as fh:
+                header = fh.read(16)
+                size = os.fstat(fh.fileno()).st_size
+        except FileNotFoundError:
+            return
+        if len(header) < 16 or header[:8] != ECACHE_MAGIC:
+            return
+        n = struct.unpack_from("<Q", header, 8)[0]
+        body = 16 + n * (16 + 4 * DIM)
+        if size < body:
+            return
+        if n:
+            self.hi = np.memmap(self.path, dtype="<u8", mode="r", offset=16, shape=(n,))
+            self.lo = np.memmap(self.path, dtype="<u8", mode="r", offset=16 + 8 * n, shape=(n,))
+            self.vecs = np.memmap(self.path, dtype="<f4", mode="r", offset=16 + 16 * n, shape=(n, DIM))
+        dt = ecache_dtype()
+        tail_rows = (size - body) // dt.itemsize  # a torn last row from a concurrent append is skipped
+        if tail_rows:
+            tail = np.fromfile(self.path, dtype=dt, count=tail_rows, offset=body)
+            self.tail = {(hi << 64) | lo: vec for hi, lo, vec in zip(tail["hi"].tolist(), tail["lo"].tolist(), tail["vec"])}
+        self.sorted_layout = True
+
+    def key(self, text: str) -> int:
+        digest = hashlib.blake2b(f"{self.embedder.name}\0{text}".encode("utf-8"), digest_size=16).digest()
+        return int.from_bytes(digest, "little")
+
+    def lookup(self, keys: list[int]) -> list[np.ndarray | None]:
+        found = [self.new.get(key, self.tail.get(key)) for key in keys]
+        rows = [row for row, vec in enumerate(found) if vec is None]
+        if rows and len(self.hi):
+            his = [keys[row] >> 64 for row in rows]
+            starts = np.searchsorted(self.hi, np.array(his, dtype=np.uint64)).tolist()
+            for row, hi, pos in zip(rows, his, starts):
+                lo = keys[row] & KEY_HALF_MASK
+                while pos < len(self.hi) and int(self.hi[pos]) == hi:
+                    if int(self.lo[pos]) == lo:
+                        found[row] = self.vecs[pos]
+                        break
+                    pos += 1
+        return found
+
+    def embed(self, texts: list[str]) -> np.ndarray:
+        if not self.embedder.cacheable:
+            return self.embedder.embed(texts)
+        keys = [self.key(text) for text in texts]
+        found = dict(zip(keys, self.lookup(keys)))
+        missing = {key: text for key, text in zip(keys, texts) if found[key] is None}
+        if missing:
+            vecs = list(self.embedder.embed(list(missing.values())))
+            self.new.update(zip(missing, vecs))
+            found.update(zip(missing, vecs))
+        PROFILE.count("embed_cache_hits", len(texts) - sum(1 for key in keys if key in missing))
+        if not texts:
+            return np.zeros((0, DIM), dtype=np.float32)
+        return np.vstack([found[key] for key in keys]).astype(np.float32, copy=False)
+
+    def append(self) -> None:
+        if not self.new:
+            return
+        if self.sorted_layout and len(self.tail) + len(self.new) < ECACHE_TAIL_ROWS:
+            rows = np.empty((len(self.new),), dtype=ecache_dtype())
+            rows["hi"] = [key >> 64 for key in self.new]
+            rows["lo"] = [key & KEY_HALF_MASK for key in self.new]
+            rows["vec"] = np.vstack(list(self.new.values()))
+            with self.path.open("ab") as fh:
+                fh.write(rows.tobytes())
+            return
+        stored = [(hi << 64) | lo for hi, lo in zip(self.hi.tolist(), self.lo.tolist())]
+        self.write_sorted(stored + list(self.tail) + list(self.new))
+
+    def rewrite(self, live_texts: list[str]) -> None:
+        if not self.embedder.cacheable:
+            self.path.unlink(missing_ok=True)
+            return
+        keys = list(dict.fromkeys(self.key(text) for text in live_texts))
+        self.write_sorted([key for key, vec in zip(keys, self.lookup(keys)) if vec is not None])
+
+    def write_sorted(self, keys: list[int]) -> None:
+        # Every key must be cached; vectors are copied ECACHE_TAIL_ROWS at a time.
+        keys = sorted(set(keys))
+        with atomic_write(self.path) as fh:
+            fh.write(ECACHE_MAGIC + struct.pack("<Q", len(keys)))
+            fh.write(np.array([key >> 64 for key in keys], dtype="<u8").tobytes())
+            fh.write(np.array([key & KEY_HALF_MASK for key in keys], dtype="<u8").tobytes())
+            for start in range(0, len(keys), ECACHE_TAIL_ROWS):
+                fh.write(np.vstack(self.lookup(keys[start : start + ECACHE_TAIL_ROWS])).astype("<f4", copy=False).tobytes())
 
 
 def parse_yaml_flow_map(expr: str) -> dict[str, Any]:
@@ -176,85 +1130,681 @@ def parse_yaml_flow_map(expr: str) -> dict[str, Any]:
     return parsed
 
 
-def compare_values(lhs: Any, rhs: Any) -> int:
-    if isinstance(lhs, (int, float)) and isinstance(rhs, (int, float)):
-        if lhs < rhs:
-            return -1
-        if lhs > rhs:
-            return 1
-        return 0
-    lhs_s = str(lhs)
-    rhs_s = str(rhs)
-    if lhs_s < rhs_s:
-        return -1
-    if lhs_s > rhs_s:
-        return 1
-    return 0
+MetadataPredicate = Callable[[dict[str, Any]], bool]
+_MISSING = object()
 
 
-def bare_equals(value: Any, expected: Any) -> bool:
-    if isinstance(value, list):
-        return any(str(v) == str(expected) for v in value)
-    return str(value) == str(expected)
+def never(_: dict[str, Any]) -> bool:
+    return False
 
 
-def eval_condition(data: dict[str, Any], key: str, cond: Any) -> bool:
-    if key not in data:
-        return False
-    value = data[key]
-
-    if isinstance(cond, dict):
-        if len(cond) != 1:
-            return False
-        op, operand = next(iter(cond.items()))
-        if op == "$gte":
-            return compare_values(value, operand) >= 0
-        if op == "$lte":
-            return compare_values(value, operand) <= 0
-        if op == "$ne":
-            return not bare_equals(value, operand)
-        if op == "$prefix":
-            return isinstance(value, str) and str(value).startswith(str(operand))
-        if op == "$contains":
-            return isinstance(value, list) and any(str(v) == str(operand) for v in value)
-        return False
+def compile_condition(key: Any, cond: Any) -> MetadataPredicate:
+    # Equality is by str() (any element for list values); ordering is numeric when
+    # both sides are numbers (NaN compares equal) and by str() otherwise. Operands are
+    # stringified once here rather than per record.
+    if not isinstance(cond, dict):
+        expected = str(cond)
+
+        def equals(data: dict[str, Any]) -> bool:
+            value = data.get(key, _MISSING)
+            if isinstance(value, list):
+                return any(str(v) == expected for v in value)
+            return value is not _MISSING and str(value) == expected
+
+        return equals
 
-    return bare_equals(value, cond)
+    if len(cond) != 1:
+        return never
+    op, operand = next(iter(cond.items()))
+    operand_s = str(operand)
 
+    if op in ("$gte", "$lte"):
+        ge = op == "$gte"
+        numeric = isinstance(operand, (int, float))
 
-def matches_filter(data: dict[str, Any], filt: dict[str, Any]) -> bool:
+        def ordered(data: dict[str, Any]) -> bool:
+            value = data.get(key, _MISSING)
+            if value is _MISSING:
+                return False
+            if numeric and isinstance(value, (int, float)):
+                return not value < operand if ge else not value > operand
+            value_s = str(value)
+            return not value_s < operand_s if ge else not value_s > operand_s
+
+        return ordered
+    if op == "$ne":
+
+        def not_equals(data: dict[str, Any]) -> bool:
+            value = data.get(key, _MISSING)
+            if isinstance(value, list):
+                return not any(str(v) == operand_s for v in value)
+            return value is not _MISSING and str(value) != operand_s
+
+        return not_equals
+    if op == "$prefix":
+        return lambda data: isinstance(value := data.get(key), str) and value.startswith(operand_s)
+    if op == "$contains":
+        return lambda data: isinstance(value := data.get(key), list) and any(str(v) == operand_s for v in value)
+    return never
+
+
+def compile_filter(filt: dict[str, Any]) -> MetadataPredicate:
+    preds: list[MetadataPredicate] = []
     for key, cond in filt.items():
-        if key == "$and":
+        if key in ("$and", "$or"):
             if not isinstance(cond, list):
-                return False
-            if not all(isinstance(c, dict) and matches_filter(data, c) for c in cond):
-                return False
+                return never
+            parts = [compile_filter(c) if isinstance(c, dict) else never for c in cond]
+            if key == "$and":
+                preds.extend(parts)
+            else:
+                preds.append(lambda data, parts=parts: any(part(data) for part in parts))
             continue
-        if key == "$or":
+        preds.append(compile_condition(key, cond))
+    if len(preds) == 1:
+        return preds[0]
+    return lambda data: all(pred(data) for pred in preds)
+
+
+# Sidecars that saves patch (.midx, .bm25) are a JSON snapshot line followed by one
+# dump_data line per save holding just that save's changes, replayed on open. A save
+# builds its line from the record store alone and appends it without reading the
+# file; each line names the generation it applies on top of ("base"), so a line
+# appended to a stale file breaks the chain and the reader rebuilds. A reader that
+# finds the appended lines outgrow max(snapshot, SIDECAR_LOG_MIN) writes a fresh
+# snapshot, as do reindex and a rebuild on open. A torn last line (a save still
+# appending) is ignored; the generation check then sends the reader to a rebuild.
+SIDECAR_LOG_MIN = 1 << 20
+SidecarSizes = tuple[int, int]  # snapshot bytes, appended patch bytes
+
+
+def read_sidecar(path: Path) -> tuple[Any, list[Any], SidecarSizes]:
+    raw = path.read_bytes()
+    end = raw.find(b"\n")
+    if end < 0:
+        return json.loads(raw), [], (len(raw), 0)
+    complete = raw.rfind(b"\n") + 1
+    patches = [load_data(line) for line in raw[end + 1 : complete].splitlines() if line]
+    return json.loads(raw[:end]), patches, (end + 1, complete - end - 1)
+
+
+def write_sidecar_snapshot(path: Path, data: Any) -> None:
+    raw = json.dumps(data, ensure_ascii=False, separators=(",", ":")).encode("utf-8") + b"\n"
+    with atomic_write(path) as fh:
+        fh.write(raw)
+
+
+def append_sidecar_patch(path: Path, patch: Any) -> None:
+    # Called under the writer lock. A missing file is left for the next reader to rebuild.
+    if not path.exists():
+        return
+    with path.open("ab") as fh:
+        fh.write(dump_data(patch) + b"\n")
+
+
+def check_sidecar_patch(generation: int, patch: dict[str, Any]) -> None:
+    if patch["base"] != generation:
+        raise ValueError(f"patch for generation {patch['base']} follows generation {generation}")
+
+
+def sidecar_log_full(sizes: SidecarSizes) -> bool:
+    return sizes[1] > max(sizes[0], SIDECAR_LOG_MIN)
+
+
+def rewrite_sidecar(paths: DbPaths, store: RecordStore, write: Callable[[], None]) -> None:
+    # Readers write a snapshot only while no save holds the lock and the store is unchanged.
+    with db_lock(paths, blocking=False) as locked:
+        if locked and len(store) > 0 and store.generation == read_generation(paths):
+            write()
+
+
+# <base>.midx holds secondary indexes for the configured metadata keys, mirroring
+# compile_condition exactly (str() equality, numeric-or-str ordering). Per key:
+#   present  ids that have the key          lists    ids whose value is a list
+#   eq       str(value) -> ids (list values add each element)
+#   numeric  ids with int/float values       nan      ids with NaN values
+#   num      sorted (value, id), non-NaN numbers, for $gte/$lte against a number
+#   strs     sorted (str(value), id), every value, for $gte/$lte otherwise
+#   text     sorted (value, id), str values, for $prefix
+# It is a JSON snapshot (sets as sorted lists, rows as pairs) followed by one patch
+# line per save (see read_sidecar), tagged with the record-store generation it matches;
+# a stale or missing file is rebuilt from the store on open.
+MIDX_VERSION = 2
+MIDX_SETS = ("present", "lists", "numeric", "nan")
+MIDX_SORTED = ("num", "strs", "text")
+
+
+def new_key_index() -> dict[str, Any]:
+    return {"present": set(), "lists": set(), "eq": {}, "numeric": set(), "nan": set(), "num": [], "strs": [], "text": []}
+
+
+def key_index_rows(doc_id: int, value: Any) -> list[tuple[str, tuple[Any, int]]]:
+    rows: list[tuple[str, tuple[Any, int]]] = [("strs", (str(value), doc_id))]
+    if isinstance(value, (int, float)) and value == value:
+        rows.append(("num", (value, doc_id)))
+    if isinstance(value, str):
+        rows.append(("text", (value, doc_id)))
+    return rows
+
+
+def key_index_add(entry: dict[str, Any], doc_id: int, value: Any, keep_sorted: bool) -> None:
+    entry["present"].add(doc_id)
+    if isinstance(value, list):
+        entry["lists"].add(doc_id)
+    for v in value if isinstance(value, list) else [value]:
+        entry["eq"].setdefault(str(v), set()).add(doc_id)
+    if isinstance(value, (int, float)):
+        entry["numeric"].add(doc_id)
+        if value != value:
+            entry["nan"].add(doc_id)
+    for name, row in key_index_rows(doc_id, value):
+        if keep_sorted:
+            bisect.insort(entry[name], row)
+        else:
+            entry[name].append(row)
+
+
+def key_index_remove(entry: dict[str, Any], doc_id: int, value: Any) -> None:
+    for name in ("present", "lists", "numeric", "nan"):
+        entry[name].discard(doc_id)
+    for v in value if isinstance(value, list) else [value]:
+        posting = entry["eq"].get(str(v))
+        if posting is not None:
+            posting.discard(doc_id)
+            if not posting:
+                del entry["eq"][str(v)]
+    for name, row in key_index_rows(doc_id, value):
+        rows = entry[name]
+        pos = bisect.bisect_left(rows, row)
+        if pos < len(rows) and rows[pos] == row:
+            del rows[pos]
+
+
+def build_metadata_index(store: RecordStore, keys: list[str]) -> dict[str, Any]:
+    midx: dict[str, Any] = {
+        "version": MIDX_VERSION,
+        "generation": store.generation,
+        "keys": {key: new_key_index() for key in keys},
+        "meta_ids": set(),
+    }
+    for doc_id in range(len(store)):
+        metadata = store.metadata(doc_id)
+        if metadata:
+            update_metadata_index(midx, doc_id, None, metadata, keep_sorted=False)
+    for entry in midx["keys"].values():
+        for name in MIDX_SORTED:
+            entry[name].sort()
+    return midx
+
+
+def update_metadata_index(
+    midx: dict[str, Any],
+    doc_id: int,
+    old: dict[str, Any] | None,
+    new: dict[str, Any] | None,
+    keep_sorted: bool = True,
+    has_metadata: bool | None = None,
+) -> None:
+    # has_metadata overrides bool(new) when `new` only holds the indexed keys.
+    for key, entry in midx["keys"].items():
+        if old and key in old:
+            key_index_remove(entry, doc_id, old[key])
+        if new and key in new:
+            key_index_add(entry, doc_id, new[key], keep_sorted)
+    if bool(new) if has_metadata is None else has_metadata:
+        midx["meta_ids"].add(doc_id)
+    else:
+        midx["meta_ids"].discard(doc_id)
+
+
+def metadata_index_data(midx: dict[str, Any]) -> dict[str, Any]:
+    keys: dict[str, Any] = {}
+    for key, entry in midx["keys"].items():
+        out = {name: sorted(entry[name]) for name in MIDX_SETS}
+        out["eq"] = {value: sorted(ids) for value, ids in entry["eq"].items()}
+        out.update((name, entry[name]) for name in MIDX_SORTED)
+        keys[key] = out
+    return {"version": midx["version"], "generation": midx["generation"], "keys": keys, "meta_ids": sorted(midx["meta_ids"])}
+
+
+def metadata_index_from_data(data: dict[str, Any]) -> dict[str, Any]:
+    keys: dict[str, Any] = {}
+    for key, stored in data["keys"].items():
+        entry = {name: set(stored[name]) for name in MIDX_SETS}
+        entry["eq"] = {value: set(ids) for value, ids in stored["eq"].items()}
+        entry.update((name, [tuple(row) for row in stored[name]]) for name in MIDX_SORTED)
+        keys[key] = entry
+    return {"version": data["version"], "generation": data["generation"], "keys": keys, "meta_ids": set(data["meta_ids"])}
+
+
+def write_metadata_index(paths: DbPaths, midx: dict[str, Any]) -> None:
+    write_sidecar_snapshot(paths.midx, metadata_index_data(midx))
+
+
+MetadataChange = tuple[int, dict[str, Any] | None, dict[str, Any] | None]  # id, old, new metadata
+
+
+def append_metadata_patch(paths: DbPaths, keys: list[str], changes: list[MetadataChange], generation: int) -> None:
+    # Records one save's changes as a patch line of the indexed keys' old and new values.
+    ops = []
+    for doc_id, old, new in changes:
+        indexed_old = {key: old[key] for key in keys if old and key in old}
+        indexed_new = {key: new[key] for key in keys if new and key in new}
+        ops.append([doc_id, indexed_old, indexed_new, bool(new)])
+    append_sidecar_patch(paths.midx, {"base": generation - 1, "generation": generation, "ops": ops})
+
+
+def apply_metadata_ops(midx: dict[str, Any], ops: list[list[Any]]) -> None:
+    for doc_id, old, new, has_metadata in ops:
+        update_metadata_index(midx, doc_id, old, new, has_metadata=has_metadata)
+
+
+def read_metadata_index(paths: DbPaths, store: RecordStore, keys: list[str], verbose: bool) -> dict[str, Any]:
+    try:
+        data, patches, sizes = read_sidecar(paths.midx)
+        if isinstance(data, dict) and data.get("version") == MIDX_VERSION and list(data.get("keys", {})) == keys:
+            midx = metadata_index_from_data(data)
+            for patch in patches:
+                check_sidecar_patch(midx["generation"], patch)
+                apply_metadata_ops(midx, patch["ops"])
+                midx["generation"] = patch["generation"]
+            if midx["generation"] == store.generation:
+                if sidecar_log_full(sizes):
+                    rewrite_sidecar(paths, store, lambda: write_metadata_index(paths, midx))
+                return midx
+    except FileNotFoundError:
+        pass
+    except Exception as e:
+        vlog(verbose, f"Ignoring metadata index {paths.midx.name}: {e}")
+    vlog(verbose, f"Rebuilding metadata index {paths.midx.name} for {keys}")
+    midx = build_metadata_index(store, keys)
+    rewrite_sidecar(paths, store, lambda: write_metadata_index(paths, midx))
+    return midx
+
+
+def open_metadata_index(paths: DbPaths, store: RecordStore, keys: list[str], verbose: bool) -> dict[str, Any]:
+    stamp = (file_stamp(paths.midx), store.generation, tuple(keys))
+    return warm(f"midx:{paths.midx}", stamp, lambda: read_metadata_index(paths, store, keys, verbose))
+
+
+def range_ids(entry: dict[str, Any], operand: Any, ge: bool) -> set[int]:
+    # Number vs number numerically (NaN compares equal), anything else by str().
+    def window(rows: list[tuple[Any, int]], bound: Any) -> list[tuple[Any, int]]:
+        if ge:
+            return rows[bisect.bisect_left(rows, (bound,)) :]
+        return rows[: bisect.bisect_left(rows, (bound, math.inf))]
+
+    by_str = {doc_id for _, doc_id in window(entry["strs"], str(operand))}
+    if not isinstance(operand, (int, float)):
+        return by_str
+    if operand != operand:
+        by_num = set(entry["numeric"])
+    else:
+        by_num = {doc_id for _, doc_id in window(entry["num"], operand)} | entry["nan"]
+    return by_num | (by_str - entry["numeric"])
+
+
+def key_index_ids(entry: dict[str, Any], cond: Any) -> set[int]:
+    if not isinstance(cond, dict):
+        return set(entry["eq"].get(str(cond), ()))
+    if len(cond) != 1:
+        return set()
+    op, operand = next(iter(cond.items()))
+    if op == "$gte":
+        return range_ids(entry, operand, ge=True)
+    if op == "$lte":
+        return range_ids(entry, operand, ge=False)
+    if op == "$ne":
+        return entry["present"] - entry["eq"].get(str(operand), set())
+    if op == "$prefix":
+        prefix = str(operand)
+        rows = entry["text"]
+        out: set[int] = set()
+        for pos in range(bisect.bisect_left(rows, (prefix,)), len(rows)):
+            if not rows[pos][0].startswith(prefix):
+                break
+            out.add(rows[pos][1])
+        return out
+    if op == "$contains":
+        return entry["eq"].get(str(operand), set()) & entry["lists"]
+    return set()
+
+
+def intersect_ids(a: set[int] | None, b: set[int] | None) -> set[int] | None:
+    if a is None:
+        return b
+    if b is None:
+        return a
+    return a & b
+
+
+def plan_filter(midx: dict[str, Any], filt: dict[str, Any]) -> tuple[set[int] | None, bool]:
+    # Returns a superset of the matching ids (None: every record with metadata) and
+    # whether it is exact; conditions on unindexed keys leave it inexact.
+    ids: set[int] | None = None
+    exact = True
+    for key, cond in filt.items():
+        if key in ("$and", "$or"):
             if not isinstance(cond, list):
-                return False
-            if not any(isinstance(c, dict) and matches_filter(data, c) for c in cond):
-                return False
+                return set(), True
+            parts = [plan_filter(midx, c) if isinstance(c, dict) else (set(), True) for c in cond]
+            exact = exact and all(part_exact for _, part_exact in parts)
+            if key == "$and":
+                for part_ids, _ in parts:
+                    ids = intersect_ids(ids, part_ids)
+                continue
+            if any(part_ids is None for part_ids, _ in parts):
+                continue
+            ids = intersect_ids(ids, set().union(*(part_ids for part_ids, _ in parts)))
             continue
-        if not eval_condition(data, key, cond):
-            return False
-    return True
+        if key not in midx["keys"]:
+            exact = False
+            continue
+        ids = intersect_ids(ids, key_index_ids(midx["keys"][key], cond))
+    return ids, exact
+
+
+def select_ids(store: RecordStore, midx: dict[str, Any], filt: dict[str, Any]) -> list[int]:
+    ids, exact = plan_filter(midx, filt)
+    candidates = sorted(midx["meta_ids"] if ids is None else ids)
+    if exact:
+        return candidates
+    pred = compile_filter(filt)
+    matched = [doc_id for doc_id in candidates if pred(store.metadata(doc_id) or {})]
+    PROFILE.count("records_scanned", len(candidates))
+    PROFILE.count("filter_rejections", len(candidates) - len(matched))
+    return matched
+
+
+# <base>.bm25 is an inverted index over body tokens (TOKEN_RE on lowercased text,
+# the same tokens the hash embedder sees) for lexical and hybrid recall:
+#   postings  token -> {id: term frequency}
+#   lengths   id -> token count, for every live non-blank record
+#   total     sum of lengths
+# Like <base>.midx it is a JSON snapshot (postings and lengths as [id, count] pairs)
+# plus one patch line per save (see read_sidecar), tagged with the record-store
+# generation, rebuilt by reindex, and rebuilt on open when stale.
+LEX_VERSION = 2
+BM25_K1 = 1.2
+BM25_B = 0.75
+
+
+def new_lexical_index(generation: int) -> dict[str, Any]:
+    return {"version": LEX_VERSION, "generation": generation, "postings": {}, "lengths": {}, "total": 0}
+
 
+def token_counts(text: str) -> dict[str, int]:
+    counts: dict[str, int] = {}
+    for token in TOKEN_RE.findall(text.lower()):
+        counts[token] = counts.get(token, 0) + 1
+    return counts
 
-def create_index() -> faiss.IndexIDMap2:
-    base = faiss.IndexHNSWFlat(DIM, 32)
-    base.hnsw.efConstruction = 200
-    base.hnsw.efSearch = 64
+
+def lexical_index_add(lex: dict[str, Any], doc_id: int, counts: dict[str, int]) -> None:
+    if not counts:
+        return
+    for token, tf in counts.items():
+        lex["postings"].setdefault(token, {})[doc_id] = tf
+    length = sum(counts.values())
+    lex["lengths"][doc_id] = length
+    lex["total"] += length
+
+
+def lexical_index_remove(lex: dict[str, Any], doc_id: int, tokens: Iterable[str]) -> None:
+    length = lex["lengths"].pop(doc_id, None)
+    if length is None:
+        return
+    lex["total"] -= length
+    for token in tokens:
+        posting = lex["postings"].get(token)
+        if posting is not None:
+            posting.pop(doc_id, None)
+            if not posting:
+                del lex["postings"][token]
+
+
+def build_lexical_index(store: RecordStore) -> dict[str, Any]:
+    lex = new_lexical_index(store.generation)
+    for doc_id in range(len(store)):
+        if not store.is_blank(doc_id) and not store.is_deleted(doc_id):
+            lexical_index_add(lex, doc_id, token_counts(store.body(doc_id)))
+    return lex
+
+
+def write_lexical_index(paths: DbPaths, lex: dict[str, Any]) -> None:
+    data = {
+        "version": lex["version"],
+        "generation": lex["generation"],
+        "postings": {token: list(posting.items()) for token, posting in lex["postings"].items()},
+        "lengths": list(lex["lengths"].items()),
+        "total": lex["total"],
+    }
+    write_sidecar_snapshot(paths.bm25, data)
+
+
+def lexical_index_from_data(data: dict[str, Any]) -> dict[str, Any]:
+    return {
+        "version": data["version"],
+        "generation": data["generation"],
+        "postings": {token: dict(pairs) for token, pairs in data["postings"].items()},
+        "lengths": dict(data["lengths"]),
+        "total": data["total"],
+    }
+
+
+def append_lexical_patch(
+    paths: DbPaths,
+    removed: dict[int, str],
+    added: list[tuple[int, str]],
+    generation: int,
+) -> None:
+    # Records one save's changes (old indexed bodies of replaced ids, new bodies to
+    # index) as a patch line with tokens and term counts.
+    patch = {
+        "base": generation - 1,
+        "generation": generation,
+        "remove": [[doc_id, list(token_counts(body))] for doc_id, body in removed.items()],
+        "add": [[doc_id, list(token_counts(body).items())] for doc_id, body in added],
+    }
+    append_sidecar_patch(paths.bm25, patch)
+
+
+def apply_lexical_patch(lex: dict[str, Any], patch: dict[str, Any]) -> None:
+    for doc_id, tokens in patch["remove"]:
+        lexical_index_remove(lex, doc_id, tokens)
+    for doc_id, pairs in patch["add"]:
+        lexical_index_add(lex, doc_id, dict(pairs))
+    lex["generation"] = patch["generation"]
+
+
+def read_lexical_index(paths: DbPaths, store: RecordStore, verbose: bool) -> dict[str, Any]:
+    try:
+        data, patches, sizes = read_sidecar(paths.bm25)
+        if isinstance(data, dict) and data.get("version") == LEX_VERSION:
+            lex = lexical_index_from_data(data)
+            for patch in patches:
+                check_sidecar_patch(lex["generation"], patch)
+                apply_lexical_patch(lex, patch)
+            if lex["generation"] == store.generation:
+                if sidecar_log_full(sizes):
+                    rewrite_sidecar(paths, store, lambda: write_lexical_index(paths, lex))
+                return lex
+    except FileNotFoundError:
+        pass
+    except Exception as e:
+        vlog(verbose, f"Ignoring lexical index {paths.bm25.name}: {e}")
+    vlog(verbose, f"Rebuilding lexical index {paths.bm25.name}")
+    lex = build_lexical_index(store)
+    rewrite_sidecar(paths, store, lambda: write_lexical_index(paths, lex))
+    return lex
+
+
+def open_lexical_index(paths: DbPaths, store: RecordStore, verbose: bool) -> dict[str, Any]:
+    stamp = (file_stamp(paths.bm25), store.generation)
+    return warm(f"bm25:{paths.bm25}", stamp, lambda: read_lexical_index(paths, store, verbose))
+
+
+def bm25_search(lex: dict[str, Any], query: str, k: int, candidate_ids: list[int] | None) -> list[Result]:
+    # Okapi BM25 over the shard's own statistics; scores are only comparable within a query.
+    n = len(lex["lengths"])
+    if n == 0:
+        return []
+    avgdl = lex["total"] / n
+    allowed = set(candidate_ids) if candidate_ids is not None else None
+    scores: dict[int, float] = {}
+    visited = 0
+    for token in token_counts(query):
+        posting = lex["postings"].get(token)
+        if not posting:
+            continue
+        visited += len(posting)
+        idf = math.log(1.0 + (n - len(posting) + 0.5) / (len(posting) + 0.5))
+        for doc_id, tf in posting.items():
+            if allowed is not None and doc_id not in allowed:
+                continue
+            norm = BM25_K1 * (1.0 - BM25_B + BM25_B * lex["lengths"][doc_id] / avgdl)
+            scores[doc_id] = scores.get(doc_id, 0.0) + idf * tf * (BM25_K1 + 1.0) / (tf + norm)
+    PROFILE.count("postings_visited", visited)
+    top = heapq.nsmallest(k, scores.items(), key=lambda item: (-item[1], item[0]))
+    return [Result(doc_id, score) for doc_id, score in top]
+
+
+RRF_K = 60
+RECALL_MODES = ("vector", "lexical", "hybrid")
+
+
+def fuse_rrf(rankings: list[list[Result]], k: int) -> list[Result]:
+    # Reciprocal rank fusion: sum of 1 / (RRF_K + rank) over the lists a record appears in.
+    scores: dict[int, float] = {}
+    for ranking in rankings:
+        for rank, result in enumerate(ranking, start=1):
+            scores[result.doc_id] = scores.get(result.doc_id, 0.0) + 1.0 / (RRF_K + rank)
+    top = heapq.nsmallest(k, scores.items(), key=lambda item: (-item[1], item[0]))
+    return [Result(doc_id, score) for doc_id, score in top]
+
+
+def create_index(
+    spec: str = DEFAULT_DB_CONFIG["index"],
+    config: dict[str, Any] = DEFAULT_DB_CONFIG,
+) -> faiss.IndexIDMap2:
+    if "IDMap" in spec:
+        raise ValueError("index spec must not include IDMap; ids are mapped by memo")
+    base = faiss.index_factory(DIM, spec)
+    inner = faiss.downcast_index(base)
+    if isinstance(inner, faiss.IndexHNSW):
+        inner.hnsw.efConstruction = int(config["ef_construction"])
+        inner.hnsw.efSearch = int(config["ef_search"])
+    ivf = faiss.try_extract_index_ivf(base)
+    if ivf is not None:
+        ivf.nprobe = min(IVF_DEFAULT_NPROBE, ivf.nlist)
     return faiss.IndexIDMap2(base)
 
 
-def load_index(path: Path, verbose: bool) -> faiss.IndexIDMap2:
-    if not path.exists():
-        return create_index()
+def finish_index(index: faiss.IndexIDMap2) -> None:
+    # IVF only reconstructs by id (exact candidate scans) with a direct map.
+    ivf = faiss.try_extract_index_ivf(index.index)
+    if ivf is not None:
+        ivf.make_direct_map()
+
+
+# Readers map <base>.memo (and IVF lists in <base>.ivfdata) instead of copying them, so
+# concurrent processes share the page cache. IO_FLAG_MMAP_IFC (zero-copy flat/HNSW codes)
+# only exists in newer FAISS builds.
+def index_mmap_flags() -> int:
+    return faiss.IO_FLAG_MMAP | faiss.IO_FLAG_READ_ONLY | getattr(faiss, "IO_FLAG_MMAP_IFC", 0)
+
+
+# <base>.memo records <base>.ivfdata by bare name: FAISS opens it relative to the working
+# directory, so reads chdir to the .memo's directory (under a lock, as the cwd is shared
+# by all threads) and a moved or copied database keeps finding its own lists.
+INDEX_READ_LOCK = threading.Lock()
+
+
+def read_index_file(path: Path, writable: bool, verbose: bool) -> faiss.Index:
+    with INDEX_READ_LOCK:
+        cwd = os.getcwd()
+        os.chdir(path.parent)
+        try:
+            if not writable:
+                try:
+                    return faiss.read_index(path.name, index_mmap_flags())
+                except RuntimeError as e:
+                    vlog(verbose, f"mmap load of {path.name} failed ({e}); reading into memory")
+            return faiss.read_index(path.name)
+        finally:
+            os.chdir(cwd)
+
+
+def ondisk_invlists(index: faiss.IndexIDMap2) -> Any:
+    ivf = faiss.try_extract_index_ivf(index.index)
+    if ivf is None:
+        return None
+    invlists = faiss.downcast_InvertedLists(ivf.invlists)
+    return invlists if isinstance(invlists, faiss.OnDiskInvertedLists) else None
+
+
+def store_invlists_ondisk(index: faiss.IndexIDMap2, paths: DbPaths) -> Path | None:
+    # Copy IVF lists into a fresh <base>.ivfdata (written under a temp name, renamed by
+    # write_index_files) so readers still mapping the old file are never disturbed. Further
+    # adds grow the temp file; write_index_files records the final name.
+    ivf = faiss.try_extract_index_ivf(index.index)
+    if ivf is None:
+        return None
+    tmp = paths.ivfdata.with_name(paths.ivfdata.name + ".tmp")
+    tmp.unlink(missing_ok=True)
+    ondisk = faiss.OnDiskInvertedLists(ivf.nlist, ivf.code_size, str(tmp))
+    sources = faiss.InvertedListsPtrVector()
+    sources.push_back(ivf.invlists)
+    ondisk.merge_from_multiple(sources.data(), sources.size(), False)
+    ivf.replace_invlists(ondisk, True)
+    return tmp
+
+
+def write_index_files(index: faiss.IndexIDMap2, paths: DbPaths, ivfdata_tmp: Path | None) -> None:
+    # Replace rather than overwrite: mmapped readers keep their inode until they reopen.
+    ensure_parent_dir(paths.index)
+    tmp = paths.index.with_name(paths.index.name + ".tmp")
+    ondisk = ondisk_invlists(index) if ivfdata_tmp is not None else None
+    if ondisk is not None:
+        ondisk.filename = paths.ivfdata.name
+    faiss.write_index(index, str(tmp))
+    if ivfdata_tmp is not None:
+        os.replace(ivfdata_tmp, paths.ivfdata)
+        if ondisk is not None:
+            ondisk.filename = str(paths.ivfdata)  # same inode as the mapped temp file
+    else:
+        paths.ivfdata.unlink(missing_ok=True)
+    os.replace(tmp, paths.index)
+
+
+def index_file_ntotal(path: Path) -> int:
+    # Every FAISS index file starts with fourcc, d (int32) and ntotal (int64), so the
+    # vector count is known without reading (or mapping) the index itself.
     try:
-        idx = faiss.read_index(str(path))
-    except Exception:
-        return create_index()
+        with path.open("rb") as fh:
+            header = fh.read(16)
+    except FileNotFoundError:
+        return 0
+    return struct.unpack_from("<q", header, 8)[0] if len(header) == 16 else 0
+
+
+def load_index(
+    path: Path,
+    verbose: bool,
+    spec: str = DEFAULT_DB_CONFIG["index"],
+    writable: bool = False,
+) -> faiss.IndexIDMap2:
+    # read_index restores whatever index type was written; spec only shapes a new, empty index.
+    # Read-only loads are mmapped and must not be modified; writers pass writable=True.
+    # Only a missing .memo means "empty"; a corrupt one, or a missing .ivfdata, is an error.
+    try:
+        idx = read_index_file(path, writable, verbose)
+    except FileNotFoundError:
+        return create_index(spec)
+    except RuntimeError as e:
+        if not path.exists():
+            return create_index(spec)
+        raise ValueError(f"failed to read index '{path}': {e}") from e
     if isinstance(idx, faiss.IndexIDMap2):
         return idx
     wrapped = faiss.IndexIDMap2(idx)
@@ -262,53 +1812,554 @@ def load_index(path: Path, verbose: bool) -> faiss.IndexIDMap2:
     return wrapped
 
 
-def get_existing_ids(index: faiss.IndexIDMap2) -> set[int]:
-    if index.ntotal == 0:
-        return set()
-    arr = faiss.vector_to_array(index.id_map)
-    return set(int(x) for x in arr.tolist())
+def train_index(
+    idx: faiss.IndexIDMap2,
+    count: int,
+    sample_vectors: Callable[[list[int]], np.ndarray],
+    verbose: bool,
+) -> None:
+    # sample_vectors maps row positions in [0, count) to their vectors.
+    if idx.is_trained or count == 0:
+        return
+    started = time.perf_counter()
+    rng = np.random.default_rng(0)
+    sample = list(range(count))
+    if count > TRAIN_SAMPLE_MAX:
+        sample = sorted(rng.choice(count, size=TRAIN_SAMPLE_MAX, replace=False).tolist())
+    try:
+        idx.train(sample_vectors(sample))
+    except RuntimeError as e:
+        raise ValueError(f"index training failed on {len(sample)} vectors: {e}") from e
+    vlog(verbose, f"Timing: train {time.perf_counter() - started:.3f}s ({len(sample)} vectors)")
+
+
+def rebuild_index_from_texts(
+    texts: list[str | None],
+    verbose: bool,
+    spec: str = DEFAULT_DB_CONFIG["index"],
+    embed: Callable[[list[str]], np.ndarray] = embed_texts,
+    config: dict[str, Any] = DEFAULT_DB_CONFIG,
+    version: int = 0,
+) -> faiss.IndexIDMap2:
+    idx = create_index(spec, config)
+    doc_ids = [doc_id for doc_id, text in enumerate(texts) if not is_blank_body(text)]
+    skipped_blank = len(texts) - len(doc_ids)
+    chunks = [doc_ids[i : i + REINDEX_CHUNK] for i in range(0, len(doc_ids), REINDEX_CHUNK)]
+    faiss.omp_set_num_threads(os.cpu_count() or 1)
+    with PROFILE.phase("train"):
+        train_index(idx, len(doc_ids), lambda rows: embed([texts[doc_ids[r]] or "" for r in rows]), verbose)
+
+    def embed_chunk(chunk: list[int]) -> tuple[np.ndarray, float]:
+        started = time.perf_counter()
+        return embed([texts[doc_id] or "" for doc_id in chunk]), time.perf_counter() - started
+
+    # Two-stage pipeline: the next chunk is embedded on a worker thread while
+    # FAISS inserts the current one (add_with_ids releases the GIL and fans out
+    # over its OpenMP threads).
+    embed_secs = 0.0
+    add_secs = 0.0
+    done = 0
+    with ThreadPoolExecutor(max_workers=1) as pool:
+        pending = pool.submit(embed_chunk, chunks[0]) if chunks else None
+        for n, chunk in enumerate(chunks):
+            vecs, secs = pending.result()
+            embed_secs += secs
+            if n + 1 < len(chunks):
+                pending = pool.submit(embed_chunk, chunks[n + 1])
+            started = time.perf_counter()
+            idx.add_with_ids(vecs, np.array([make_label(doc_id, version) for doc_id in chunk], dtype=np.int64))
+            add_secs += time.perf_counter() - started
+            done += len(chunk)
+            vlog(verbose, f"Indexed {done}/{len(doc_ids)} vectors")
+
+    finish_index(idx)
+    PROFILE.add_time("embed", embed_secs)
+    PROFILE.add_time("add", add_secs)
+    vlog(verbose, f"Rebuilt index with {len(doc_ids)} vectors (skipped {skipped_blank} blank records)")
+    vlog(verbose, f"Timing: embed {embed_secs:.3f}s, add {add_secs:.3f}s ({faiss.omp_get_max_threads()} threads)")
+    return idx
 
 
-def rebuild_index_from_texts(texts: list[str | None], verbose: bool) -> faiss.IndexIDMap2:
-    idx = create_index()
-    indexed = 0
-    skipped_blank = 0
-    for doc_id, text in enumerate(texts):
-        note = text or ""
-        if is_blank_body(note):
-            skipped_blank += 1
-            continue
-        vec = embed_text_hash(note)
-        idx.add_with_ids(vec.reshape(1, -1), np.array([doc_id], dtype=np.int64))
-        indexed += 1
-    vlog(verbose, f"Rebuilt index with {indexed} vectors (skipped {skipped_blank} blank records)")
-    return idx
+def faiss_distance_count() -> int:
+    # Distance computations recorded by FAISS's global HNSW/IVF search stats.
+    cvar = getattr(faiss, "cvar", None)
+    total = 0
+    for name in ("hnsw_stats", "indexIVF_stats"):
+        total += int(getattr(getattr(cvar, name, None), "ndis", 0))
+    return total
 
 
-def search_all(index: faiss.IndexIDMap2, query_vec: np.ndarray) -> list[Result]:
-    if index.ntotal == 0:
+@dataclass
+class SearchTuning:
+    # Per-recall search effort; None keeps the value stored in the index.
+    ef: int | None = None
+    nprobe: int | None = None
+    overfetch: int = RECALL_OVERFETCH
+
+
+SEARCH_PRESETS = {
+    "fast": SearchTuning(ef=16, nprobe=4, overfetch=2),
+    "balanced": SearchTuning(),
+    "accurate": SearchTuning(ef=256, nprobe=64, overfetch=8),
+}
+
+
+def make_search_params(
+    index: faiss.IndexIDMap2,
+    selector: faiss.IDSelector | None,
+    tuning: SearchTuning | None = None,
+) -> Any:
+    tuning = tuning or SearchTuning()
+    inner = faiss.downcast_index(index.index)
+    if isinstance(inner, faiss.IndexHNSW):
+        return faiss.SearchParametersHNSW(sel=selector, efSearch=tuning.ef or inner.hnsw.efSearch)
+    ivf = faiss.try_extract_index_ivf(inner)
+    if ivf is not None:
+        return faiss.SearchParametersIVF(sel=selector, nprobe=min(tuning.nprobe or ivf.nprobe, ivf.nlist))
+    return faiss.SearchParameters(sel=selector)
+
+
+def make_id_selector(candidate_ids: np.ndarray, id_bound: int) -> tuple[faiss.IDSelector, Any]:
+    # Dense candidate sets use a bitmap over the id space; sparse ones a hashed batch.
+    if len(candidate_ids) * 16 >= id_bound:
+        bitmap = np.zeros(((id_bound + 7) // 8,), dtype=np.uint8)
+        np.bitwise_or.at(bitmap, candidate_ids >> 3, (1 << (candidate_ids & 7)).astype(np.uint8))
+        return faiss.IDSelectorBitmap(id_bound, faiss.swig_ptr(bitmap)), bitmap
+    return faiss.IDSelectorBatch(len(candidate_ids), faiss.swig_ptr(candidate_ids)), candidate_ids
+
+
+def is_similarity_metric(metric_type: int) -> bool:
+    return metric_type == faiss.METRIC_INNER_PRODUCT
+
+
+def scan_vectors(
+    metric_type: int,
+    query_vec: np.ndarray,
+    labels: np.ndarray,
+    vecs: np.ndarray,
+    k: int,
+) -> list[tuple[int, float]]:
+    if len(labels) == 0:
         return []
-    k = int(index.ntotal)
-    scores, ids = index.search(query_vec.reshape(1, -1), k)
+    if is_similarity_metric(metric_type):
+        scores = vecs @ query_vec
+        order = np.argsort(-scores, kind="stable")
+    else:
+        scores = ((vecs - query_vec) ** 2).sum(axis=1)
+        order = np.argsort(scores, kind="stable")
+    return [(int(labels[i]), float(scores[i])) for i in order[:k].tolist()]
+
+
+# Vectors added since the last merge live in <base>.delta as raw (label, vector)
+# rows. Saves only append there; the delta is scanned exactly at query time and
+# folded into <base>.memo once it reaches DELTA_MERGE_ROWS or on reindex.
+DELTA_MERGE_ROWS = 4096
+
+
+def delta_dtype() -> np.dtype:
+    return np.dtype([("label", "<i8"), ("vec", "<f4", (DIM,))])
+
+
+def read_delta(path: Path) -> tuple[np.ndarray, np.ndarray]:
+    dt = delta_dtype()
+    raw = np.fromfile(path, dtype=np.uint8) if path.exists() else np.zeros((0,), dtype=np.uint8)
+    rows = raw[: len(raw) - len(raw) % dt.itemsize].view(dt)
+    if len(rows) == 0:
+        return np.zeros((0,), dtype=np.int64), np.zeros((0, DIM), dtype=np.float32)
+    # A label written more than once (interrupted save) keeps its last row.
+    _, last_from_end = np.unique(rows["label"][::-1], return_index=True)
+    rows = rows[np.sort(len(rows) - 1 - last_from_end)]
+    return rows["label"].astype(np.int64), np.ascontiguousarray(rows["vec"], dtype=np.float32)
+
+
+def pack_delta(labels: np.ndarray, vecs: np.ndarray) -> bytes:
+    rows = np.empty((len(labels),), dtype=delta_dtype())
+    rows["label"] = labels
+    rows["vec"] = vecs
+    return rows.tobytes()
+
+
+def append_delta(path: Path, labels: np.ndarray, vecs: np.ndarray) -> int:
+    with path.open("ab") as fh:
+        fh.write(pack_delta(labels, vecs))
+        return fh.tell() // delta_dtype().itemsize
+
+
+# <base>.tomb lists the labels of vectors still stored in <base>.memo or <base>.delta
+# that recall must not return: superseded versions and soft-deleted records. Saves
+# append to it and recall excludes them inside the search itself. Once they make up
+# compact_ratio of the stored vectors, a save starts `memo compact` in the background,
+# which rebuilds the index from its stored vectors without them (ids are unchanged,
+# unlike reindex). Merges, compaction and reindex prune labels that are gone.
+COMPACT_MIN_DEAD = 1024
+
+
+def read_tombstones(path: Path) -> np.ndarray:
+    raw = np.fromfile(path, dtype=np.uint8) if path.exists() else np.zeros((0,), dtype=np.uint8)
+    return np.unique(raw[: len(raw) - len(raw) % 8].view("<i8").astype(np.int64))
+
+
+def append_tombstones(path: Path, labels: list[int]) -> None:
+    if labels:
+        with path.open("ab") as fh:
+            fh.write(np.array(labels, dtype="<i8").tobytes())
+
+
+def write_tombstones(path: Path, labels: np.ndarray | list[int]) -> None:
+    with atomic_write(path) as fh:
+        fh.write(np.asarray(labels, dtype="<i8").tobytes())
+
+
+def prune_tombstones(paths: DbPaths, main_labels: np.ndarray) -> None:
+    dead = read_tombstones(paths.tomb)
+    present = np.concatenate([main_labels, read_delta(paths.delta)[0]])
+    kept = dead[np.isin(dead, present)]
+    if len(kept) < len(dead) or not paths.tomb.exists():
+        write_tombstones(paths.tomb, kept)
+
+
+def is_live_label(store: RecordStore, label: int) -> bool:
+    doc_id = label_doc_id(label)
+    return not (store.is_blank(doc_id) or store.is_deleted(doc_id)) and store.label(doc_id) == label
+
+
+def scan_tombstones(paths: DbPaths, store: RecordStore, verbose: bool) -> np.ndarray:
+    # Recovers <base>.tomb for a database written before it existed (or after it was lost).
+    index = load_index(paths.index, verbose, FLAT_INDEX_SPEC)
+    labels = np.concatenate([faiss.vector_to_array(index.id_map).astype(np.int64), read_delta(paths.delta)[0]])
+    return np.array([label for label in labels.tolist() if not is_live_label(store, label)], dtype=np.int64)
+
+
+class MemoIndex:
+    # Searches the main index and the delta together. Everything here is in
+    # FAISS labels; callers map them back to record ids and drop stale versions.
+    def __init__(
+        self,
+        main: faiss.IndexIDMap2,
+        delta_labels: np.ndarray,
+        delta_vecs: np.ndarray,
+        dead: np.ndarray | None = None,
+    ) -> None:
+        self.main = main
+        self.delta_labels = delta_labels
+        self.delta_vecs = delta_vecs
+        self.dead = dead if dead is not None else np.zeros((0,), dtype=np.int64)
+        self._delta_pos = {label: row for row, label in enumerate(delta_labels.tolist())}
+        self._exclude: Any = None
+
+    def exclude_dead(self) -> Any:
+        # IDSelectorNot over the tombstones, with the arrays backing it; built once.
+        if self._exclude is None:
+            selector, keepalive = make_id_selector(self.dead, int(self.dead.max()) + 1)
+            self._exclude = (faiss.IDSelectorNot(selector), selector, keepalive)
+        return self._exclude
+
+    def drop_dead(self, labels: np.ndarray) -> np.ndarray:
+        return labels[~np.isin(labels, self.dead)] if len(self.dead) > 0 else labels
+
+    @property
+    def ntotal(self) -> int:
+        return int(self.main.ntotal) + len(self.delta_labels)
+
+    @property
+    def metric_type(self) -> int:
+        return int(self.main.metric_type)
+
+    @property
+    def quantized(self) -> bool:
+        return is_quantized_index(self.main)
+
+    def reconstruct(self, label: int) -> np.ndarray | None:
+        row = self._delta_pos.get(label)
+        if row is not None:
+            return self.delta_vecs[row]
+        try:
+            return self.main.reconstruct(label)
+        except RuntimeError:
+            return None
+
+    def search(
+        self,
+        query_vec: np.ndarray,
+        k: int,
+        candidates: np.ndarray | None = None,
+        tuning: SearchTuning | None = None,
+    ) -> list[tuple[int, float]]:
+        return self.search_batch(query_vec.reshape(1, -1), k, candidates, tuning)[0]
+
+    def search_batch(
+        self,
+        query_mat: np.ndarray,
+        k: int,
+        candidates: np.ndarray | None = None,
+        tuning: SearchTuning | None = None,
+    ) -> list[list[tuple[int, float]]]:
+        nq = len(query_mat)
+        if k < 1:
+            return [[] for _ in range(nq)]
+        out: list[list[tuple[int, float]]] = [[] for _ in range(nq)]
+        if self.main.ntotal > 0:
+            selector = None
+            keepalive: Any = None  # backing storage for the selector; must outlive the search
+            if candidates is not None:
+                # Candidate sets come from live records; see collect_recall_results.
+                selector, keepalive = make_id_selector(candidates, int(candidates.max()) + 1)
+            elif len(self.dead) > 0:
+                keepalive = self.exclude_dead()
+                selector = keepalive[0]
+            params = make_search_params(self.main, selector, tuning)
+            # One call for all queries; FAISS spreads the rows across its OpenMP threads.
+            before = faiss_distance_count()
+            scores, labels = self.main.search(query_mat, min(k, int(self.main.ntotal)), params=params)
+            # Flat indexes keep no stats: they compare every (selected) vector.
+            visited = faiss_distance_count() - before
+            PROFILE.count("vectors_visited", visited or nq * (len(candidates) if candidates is not None else int(self.main.ntotal)))
+            for row, (row_scores, row_labels) in enumerate(zip(scores.tolist(), labels.tolist())):
+                out[row].extend((int(label), float(s)) for s, label in zip(row_scores, row_labels) if label >= 0)
+
+        if len(self.delta_labels) > 0:
+            labels, vecs = self.delta_labels, self.delta_vecs
+            if candidates is not None:
+                mask = np.isin(labels, candidates)
+                labels, vecs = labels[mask], vecs[mask]
+            elif len(self.dead) > 0:
+                mask = ~np.isin(labels, self.dead)
+                labels, vecs = labels[mask], vecs[mask]
+            PROFILE.count("vectors_visited", nq * len(labels))
+            for row in range(nq):
+                out[row].extend(scan_vectors(self.metric_type, query_mat[row], labels, vecs, k))
+
+        similarity = is_similarity_metric(self.metric_type)
+        for row in range(nq):
+            out[row].sort(key=lambda hit: -hit[1] if similarity else hit[1])
+            del out[row][k:]
+        return out
+
+    def exact_search(self, query_vec: np.ndarray, candidates: list[int], k: int) -> list[tuple[int, float]]:
+        rows: list[np.ndarray] = []
+        labels: list[int] = []
+        for label in candidates:
+            vec = self.reconstruct(label)
+            if vec is None:
+                continue
+            rows.append(vec)
+            labels.append(label)
+        if not rows:
+            return []
+        PROFILE.count("vectors_visited", len(rows))
+        return scan_vectors(self.metric_type, query_vec, np.array(labels, dtype=np.int64), np.vstack(rows), k)
+
+
+def open_vector_index(paths: DbPaths, verbose: bool) -> MemoIndex:
+    spec = index_spec_for(load_db_config(paths), 0)
+    main = warm(f"index:{paths.index}", file_stamp(paths.index), lambda: load_index(paths.index, verbose, spec))
+    delta_labels, delta_vecs = warm(f"delta:{paths.delta}", file_stamp(paths.delta), lambda: read_delta(paths.delta))
+    dead = warm(f"tomb:{paths.tomb}", file_stamp(paths.tomb), lambda: read_tombstones(paths.tomb))
+    vlog(verbose and len(delta_labels) > 0, f"Loaded {len(delta_labels)} delta vectors from {paths.delta.name}")
+    vlog(verbose and len(dead) > 0, f"Excluding {len(dead)} tombstoned vectors listed in {paths.tomb.name}")
+    return MemoIndex(main, delta_labels, delta_vecs, dead)
+
+
+def is_quantized_index(index: faiss.IndexIDMap2) -> bool:
+    # Lossy codes unless the vectors are stored as plain floats (Flat, HNSW over Flat, IVFFlat).
+    inner = faiss.downcast_index(index.index)
+    if isinstance(inner, faiss.IndexHNSW):
+        inner = faiss.downcast_index(inner.storage)
+    return not isinstance(inner, (faiss.IndexFlat, faiss.IndexIVFFlat))
+
+
+def rebuild_from_vectors(
+    index: faiss.IndexIDMap2,
+    keep: np.ndarray,
+    spec: str,
+    verbose: bool,
+    config: dict[str, Any] = DEFAULT_DB_CONFIG,
+    vectors: Callable[[np.ndarray], np.ndarray] | None = None,
+) -> faiss.IndexIDMap2:
+    # Builds a `spec` index from the rows of `index` where `keep` is set. vectors maps
+    # row positions to their vectors; by default they are read back from `index` (no
+    # re-embedding), which is only exact for float storage. Raises ValueError if too
+    # few remain to train.
+    if vectors is None:
+        vectors = index.index.reconstruct_batch
+    labels = faiss.vector_to_array(index.id_map).astype(np.int64)
+    rows = np.flatnonzero(keep)
+    rebuilt = create_index(spec, config)
+    train_index(rebuilt, len(rows), lambda sample: vectors(rows[np.array(sample, dtype=np.int64)]), verbose)
+    for start in range(0, len(rows), REINDEX_CHUNK):
+        chunk = rows[start : start + REINDEX_CHUNK]
+        rebuilt.add_with_ids(vectors(chunk), labels[chunk])
+    finish_index(rebuilt)
+    return rebuilt
+
+
+def migrate_flat_index(
+    paths: DbPaths,
+    index: faiss.IndexIDMap2,
+    spec: str,
+    verbose: bool,
+    config: dict[str, Any] = DEFAULT_DB_CONFIG,
+) -> faiss.IndexIDMap2:
+    # Stale and tombstoned labels are left behind.
+    started = time.perf_counter()
+    store = open_record_store(paths, verbose)
+    labels = faiss.vector_to_array(index.id_map).astype(np.int64)
+    live = np.array([store.label(label_doc_id(int(label))) == label for label in labels], dtype=bool)
+    live &= ~np.isin(labels, read_tombstones(paths.tomb))
+    try:
+        migrated = rebuild_from_vectors(index, live, spec, verbose, config)
+    except ValueError as e:
+        vlog(verbose, f"Keeping flat index: {e}")
+        return index
+    vlog(verbose, f"Timing: migrate to {spec} {time.perf_counter() - started:.3f}s ({int(live.sum())} vectors)")
+    return migrated
+
+
+def merge_delta(paths: DbPaths, verbose: bool) -> None:
+    config = load_db_config(paths)
+    delta_labels, delta_vecs = read_delta(paths.delta)
+    index = load_index(paths.index, verbose, index_spec_for(config, 0), writable=True)
+    if not index.is_trained:
+        # Trained indexes (IVF, PQ, SQ) are built by reindex; until then recall reads the delta.
+        vlog(verbose, f"{paths.index.name} is untrained; keeping {len(delta_labels)} vectors in {paths.delta.name}")
+        return
+    ivfdata_tmp = store_invlists_ondisk(index, paths)
+    live = ~np.isin(delta_labels, read_tombstones(paths.tomb))
+    if live.any():
+        index.add_with_ids(delta_vecs[live], delta_labels[live])
+    # Small stores start on an exact flat index and move to the configured type once they outgrow it.
+    try:
+        target = index_spec_for(config, index.ntotal)
+    except ValueError as e:
+        vlog(verbose, f"Keeping flat index: {e}")
+        target = FLAT_INDEX_SPEC
+    if target != FLAT_INDEX_SPEC and isinstance(faiss.downcast_index(index.index), faiss.IndexFlat):
+        index = migrate_flat_index(paths, index, target, verbose, config)
+        ivfdata_tmp = store_invlists_ondisk(index, paths)
+    write_index_files(index, paths, ivfdata_tmp)
+    paths.delta.unlink(missing_ok=True)
+    prune_tombstones(paths, faiss.vector_to_array(index.id_map).astype(np.int64))
+    vlog(verbose, f"Merged {int(live.sum())} delta vectors into {paths.index.name}")
+
+
+def filter_candidate_ids(store: RecordStore, midx: dict[str, Any], active_filter: dict[str, Any]) -> list[int]:
+    return [doc_id for doc_id in select_ids(store, midx, active_filter) if not store.is_blank(doc_id)]
+
+
+def live_results(hits: list[tuple[int, float]], store: RecordStore, k: int) -> list[Result]:
     out: list[Result] = []
-    for s, doc_id in zip(scores[0].tolist(), ids[0].tolist()):
-        if doc_id < 0:
+    for label, score in hits:
+        if len(out) >= k:
+            break
+        if score < -0.9:
+            continue
+
+        doc_id = label_doc_id(label)
+        if store.is_blank(doc_id) or store.label(doc_id) != label:
+            PROFILE.count("stale_hits")
             continue
-        out.append(Result(int(doc_id), float(s)))
+        out.append(Result(doc_id, score))
     return out
 
 
-def print_recall_result_multiline(doc_id: int, score: float, text: str) -> None:
-    print(f"  [{doc_id}] Score: {score:.4f} |")
+def collect_recall_results(
+    index: MemoIndex,
+    query_vec: np.ndarray,
+    k: int,
+    store: RecordStore,
+    candidate_ids: list[int] | None,
+    tuning: SearchTuning,
+) -> list[Result]:
+    candidates: np.ndarray | None = None
+    ntotal = index.ntotal
+    if candidate_ids is not None:
+        if not candidate_ids:
+            return []
+        candidates = index.drop_dead(np.array([store.label(doc_id) for doc_id in candidate_ids], dtype=np.int64))
+        if len(candidates) == 0:
+            return []
+        if len(candidates) <= EXACT_SCAN_MAX:
+            return live_results(index.exact_search(query_vec, candidates.tolist(), k), store, k)
+        ntotal = min(ntotal, len(candidates))
+
+    fetch = min(ntotal, k * tuning.overfetch)
+    while True:
+        hits = live_results(index.search(query_vec, fetch, candidates, tuning), store, k)
+        if len(hits) >= k or fetch >= ntotal:
+            return hits
+        fetch = min(ntotal, fetch * 2)
+
+
+def collect_recall_batch(
+    index: MemoIndex,
+    query_mat: np.ndarray,
+    ks: list[int],
+    store: RecordStore,
+    candidate_ids: list[list[int] | None],
+    tuning: SearchTuning,
+) -> list[list[Result]]:
+    # Unfiltered queries share one batched search; a query left short by
+    # blank/stale hits, and every filtered query, falls back to its own search.
+    out: list[list[Result] | None] = [None] * len(ks)
+    plain = [row for row, cands in enumerate(candidate_ids) if cands is None]
+    ntotal = index.ntotal
+    if plain and ntotal > 0:
+        fetch = min(ntotal, max(ks[row] for row in plain) * tuning.overfetch)
+        for row, hits in zip(plain, index.search_batch(query_mat[plain], fetch, None, tuning)):
+            results = live_results(hits, store, ks[row])
+            if len(results) >= ks[row] or fetch >= ntotal:
+                out[row] = results
+
+    for row, results in enumerate(out):
+        if results is None:
+            out[row] = collect_recall_results(index, query_mat[row], ks[row], store, candidate_ids[row], tuning)
+    return [results or [] for results in out]
+
+
+def rerank_results(
+    results: list[Result],
+    query_vec: np.ndarray,
+    store: RecordStore,
+    cache: EmbedCache,
+    similarity: bool,
+    k: int,
+) -> list[Result]:
+    # Exact float scores for hits from a quantized index, from the re-embedded bodies.
+    if not results:
+        return results
+    vecs = cache.embed([store.body(r.doc_id) for r in results])
+    if similarity:
+        scores = vecs @ query_vec
+    else:
+        scores = ((vecs - query_vec) ** 2).sum(axis=1)
+    PROFILE.count("reranked", len(results))
+    order = np.argsort(-scores if similarity else scores, kind="stable")[:k]
+    return [Result(results[row].doc_id, float(scores[row])) for row in order.tolist()]
+
+
+def print_recall_result_multiline(doc_id: int, score: float, text: str, base: str | None = None) -> None:
+    label = doc_id if base is None else f"{base}:{doc_id}"
+    print(f"  [{label}] Score: {score:.4f} |")
     lines = text.splitlines() or [""]
     for ln in lines:
         print(f"      {ln}")
 
 
 def command_clean(db_base: str, user_cwd: str) -> int:
-    index_path, yaml_path = build_db_paths(db_base, user_cwd)
+    paths = build_db_paths(db_base, user_cwd)
+    with db_lock(paths):
+        return clean_files(paths)
+
+
+def clean_files(paths: DbPaths) -> int:
+    index_path, yaml_path = paths.index, paths.yaml
     removed_any = False
-    for p in (index_path, yaml_path):
+    try:
+        shards = shard_paths(paths, load_db_config(paths))
+    except ValueError:
+        shards = [paths]
+    files = [p for shard in shards if shard is not paths for p in shard.files()] + paths.files()
+    for p in files:
         try:
             p.unlink()
             removed_any = True
@@ -331,201 +2382,980 @@ def command_clean(db_base: str, user_cwd: str) -> int:
     return 0
 
 
-def command_reindex(db_base: str, user_cwd: str, verbose: bool) -> int:
-    index_path, yaml_path = build_db_paths(db_base, user_cwd)
+def command_reindex(
+    db_base: str,
+    user_cwd: str,
+    verbose: bool,
+    conf_updates: dict[str, Any] | None = None,
+    shards: int | None = None,
+    shard_key: str | None = None,
+) -> int:
+    # conf_updates: <base>.conf entries given on the command line (--index, --embedder).
+    conf_updates = conf_updates or {}
+    paths = build_db_paths(db_base, user_cwd)
+    with db_lock(paths):
+        try:
+            config = load_db_config(paths)
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+        if shards is not None or shard_key is not None:
+            # --shards alone drops the shard key; --shard-key alone keeps the shard count.
+            target = shards if shards is not None else config["shards"]
+            return reshard(paths, config, target, shard_key, verbose, conf_updates)
+        if config["shards"] <= 1:
+            return reindex_files(paths, verbose, conf_updates)
+        for shard in shard_paths(paths, config):
+            with db_lock(shard):
+                rc = reindex_files(shard, verbose, conf_updates)
+            if rc != 0:
+                return rc
+        if conf_updates:
+            config.update(conf_updates)
+            save_db_config(paths, config)
+        return 0
+
 
+def reshard(
+    paths: DbPaths,
+    config: dict[str, Any],
+    shards: int,
+    shard_key: str | None,
+    verbose: bool,
+    conf_updates: dict[str, Any],
+) -> int:
+    # Gathers every live record in global id order, redistributes them and reindexes
+    # each new shard. Ids are re-sequenced, as with any reindex.
+    records: list[tuple[int, str, dict[str, Any] | None]] = []
+    old = shard_paths(paths, config)
     try:
-        texts, metas = load_yaml_tables(yaml_path)
+        for shard, shard_db in enumerate(old):
+            live, _ = read_live_records(shard_db, verbose)
+            records.extend((doc_id * len(old) + shard, text, metadata) for doc_id, text, metadata in live)
     except Exception as e:
-        print(f"Error: failed to load database YAML '{yaml_path}': {e}", file=sys.stderr)
+        print(f"Error: failed to load database YAML '{paths.yaml}': {e}", file=sys.stderr)
+        return 1
+    records.sort(key=lambda record: record[0])
+
+    routed: list[tuple[list[str], list[dict[str, Any] | None]]] = [([], []) for _ in range(shards)]
+    for position, (_, text, metadata) in enumerate(records):
+        keyed = shard_key is not None and shard_key in (metadata or {})
+        if keyed and isinstance(metadata[shard_key], list):
+            print(f"Error: shard key '{shard_key}' must be a scalar, not a list", file=sys.stderr)
+            return 1
+        if keyed:
+            shard = shard_for_value(metadata[shard_key], shards)
+        elif shard_key is not None:
+            shard = min(range(shards), key=lambda i: len(routed[i][0]))
+        else:
+            shard = position % shards
+        routed[shard][0].append(text)
+        routed[shard][1].append(metadata)
+
+    target = {**config, **conf_updates, "shards": shards, "shard_key": shard_key if shards > 1 else None}
+    shard_config = {key: value for key, value in target.items() if key not in SHARD_CONFIG_KEYS}
+    new = shard_paths(paths, target)
+    epoch = version_epoch(old + new, verbose)
+    # New shards are built under their final names in a scratch directory next to the
+    # base (.memo refers to .ivfdata by name), so a failure leaves the old layout intact
+    # even when a target shard is also a source. They are swapped in file by file, the
+    # base .conf goes last, and only then are source shards that are not kept removed.
+    ensure_parent_dir(paths.conf)
+    scratch = Path(tempfile.mkdtemp(prefix=f".{paths.stem.name}.reshard-", dir=paths.stem.parent))
+    try:
+        built = [db_paths_for_stem(scratch / shard_db.stem.name) for shard_db in new]
+        for shard_db, (texts, metas) in zip(built, routed):
+            save_yaml_tables(shard_db.yaml, texts, metas)
+            save_db_config(shard_db, shard_config)
+            rc = reindex_files(shard_db, verbose, {}, epoch)
+            if rc != 0:
+                return rc
+        for shard_db, staged in zip(new, built):
+            with db_lock(shard_db):
+                # The index goes last: a reader that sees the new .memo finds the new records.
+                for final, tmp in sorted(zip(shard_db.files(), staged.files()), key=lambda pair: pair[0] == shard_db.index):
+                    if tmp.exists():
+                        os.replace(tmp, final)
+                    else:
+                        final.unlink(missing_ok=True)
+    finally:
+        for p in scratch.iterdir():
+            p.unlink()
+        scratch.rmdir()
+    save_db_config(paths, target)
+    new_stems = {shard_db.stem for shard_db in new}
+    for shard_db in old:
+        if shard_db.stem not in new_stems:
+            for p in shard_db.files():
+                if p != paths.conf:
+                    p.unlink(missing_ok=True)
+    if shards > 1:
+        by = f" by '{shard_key}'" if shard_key is not None else ""
+        print(f"Sharded {len(records)} records into {shards} shards{by}")
+    return 0
+
+
+def version_epoch(stems: list[DbPaths], verbose: bool) -> int:
+    # Rebuilt records all take a version above any label the old files hold. Readers take
+    # no lock, so one may pair the old .memo with the new .rix (or the reverse); with ids
+    # re-sequenced, the other side's labels then fail the liveness check instead of
+    # matching different records.
+    epoch = 0
+    for stem in stems:
+        store = try_open_record_store(stem, verbose)
+        if store is not None and store.count > 0:
+            epoch = max(epoch, int(store.version_array().max()) + 1)
+    return epoch
+
+
+def reindex_files(paths: DbPaths, verbose: bool, conf_updates: dict[str, Any], epoch: int | None = None) -> int:
+    index_path, yaml_path = paths.index, paths.yaml
+    try:
+        config = {**load_db_config(paths), **conf_updates}
+        cache = EmbedCache(paths.ecache, get_embedder(config["embedder"]))
+    except ValueError as e:
+        print(f"Error: {e}", file=sys.stderr)
         return 1
 
     # Compact records before rebuild: drop blank/deleted entries and re-sequence IDs.
-    compact_texts: list[str] = []
-    compact_metas: list[dict[str, Any] | None] = []
-    dropped = 0
-    for i, text in enumerate(texts):
-        metadata = metas[i] if i < len(metas) else None
-        if is_blank_body(text) or is_deleted_record(metadata, text):
-            dropped += 1
-            continue
-        compact_texts.append(text)
-        compact_metas.append(metadata)
+    started = time.perf_counter()
+    try:
+        with PROFILE.phase("parse"):
+            live, total = read_live_records(paths, verbose)
+    except Exception as e:
+        print(f"Error: failed to load database YAML '{yaml_path}': {e}", file=sys.stderr)
+        return 1
+    PROFILE.count("records_scanned", total)
+    vlog(verbose, f"Timing: parse {time.perf_counter() - started:.3f}s ({total} records)")
+    compact_texts = [text for _, text, _ in live]
+    compact_metas = [metadata for _, _, metadata in live]
+    dropped = total - len(live)
+    if epoch is None:
+        epoch = version_epoch([paths], verbose)
+
+    # The new index is built and trained in memory first: nothing on disk changes
+    # until it succeeds, so a bad --index spec leaves the old ids and labels intact.
+    spec = config["index"]  # reported as-is when the spec itself is rejected
+    try:
+        spec = index_spec_for(config, sum(1 for text in compact_texts if not is_blank_body(text)))
+        index = rebuild_index_from_texts(compact_texts, verbose, spec, cache.embed, config, epoch)
+    except (ValueError, RuntimeError) as e:
+        print(f"Error: cannot build index '{spec}': {e}", file=sys.stderr)
+        return 1
 
     # Canonicalize YAML formatting and persist compacted IDs on reindex.
-    ensure_parent_dir(yaml_path)
-    save_yaml_tables(yaml_path, compact_texts, compact_metas)
-
-    index = rebuild_index_from_texts(compact_texts, verbose)
-    ensure_parent_dir(index_path)
-    faiss.write_index(index, str(index_path))
+    started = time.perf_counter()
+    with PROFILE.phase("write_records"):
+        ensure_parent_dir(yaml_path)
+        save_yaml_tables(yaml_path, compact_texts, compact_metas)
+        write_record_store(paths, compact_texts, compact_metas, read_generation(paths) + 1, [epoch] * len(compact_texts))
+        store = RecordStore.open(paths)
+        write_metadata_index(paths, build_metadata_index(store, config["indexed_keys"]))
+        write_lexical_index(paths, build_lexical_index(store))
+    vlog(verbose, f"Timing: write records {time.perf_counter() - started:.3f}s")
+
+    started = time.perf_counter()
+    with PROFILE.phase("write_index"):
+        write_index_files(index, paths, store_invlists_ondisk(index, paths))
+        paths.delta.unlink(missing_ok=True)
+        write_tombstones(paths.tomb, [])
+        cache.rewrite(compact_texts)
+        if conf_updates:
+            save_db_config(paths, config)
+    vlog(verbose, f"Timing: write index {time.perf_counter() - started:.3f}s")
     print(f"Rebuilt index from {yaml_path.name}")
-    print(f"Wrote index: {index_path.name}")
+    print(f"Wrote index: {index_path.name} ({spec})")
     if dropped > 0:
         print(f"Compacted: dropped {dropped} blank/deleted entries")
     return 0
 
 
-def parse_save_yaml_file(path: Path) -> list[dict[str, Any]]:
-    if not path.exists():
-        raise ValueError(f"failed to read input file '{path}'")
-    text = path.read_text(encoding="utf-8")
-    docs = list(yaml.safe_load_all(text))
-    entries: list[dict[str, Any]] = []
+# Saves stream their input: documents are parsed one at a time and written in
+# SAVE_STREAM_BATCH batches, so memory is bounded by the batch, not the input.
+SAVE_STREAM_BATCH = 4096
 
-    for doc in docs:
-        if doc is None:
-            continue
-        if not isinstance(doc, dict):
-            raise ValueError("each YAML document must be a mapping")
-        if "body" not in doc:
-            raise ValueError("each YAML document requires 'body'")
-        body = doc.get("body")
-        if not isinstance(body, str) or body.strip() == "":
-            raise ValueError("body must be a non-empty string")
 
-        metadata = doc.get("metadata")
-        if metadata is not None and not isinstance(metadata, dict):
-            raise ValueError("metadata must be a mapping when provided")
+def save_entry_from_doc(doc: Any) -> dict[str, Any] | None:
+    if doc is None:
+        return None
+    if not isinstance(doc, dict):
+        raise ValueError("each YAML document must be a mapping")
+    if "body" not in doc:
+        raise ValueError("each YAML document requires 'body'")
+    body = doc.get("body")
+    if not isinstance(body, str) or body.strip() == "":
+        raise ValueError("body must be a non-empty string")
+
+    metadata = doc.get("metadata")
+    if metadata is not None and not isinstance(metadata, dict):
+        raise ValueError("metadata must be a mapping when provided")
+
+    rec: dict[str, Any] = {"body": body, "metadata": metadata}
+    if "id" in doc:
+        if not isinstance(doc["id"], int) or doc["id"] < 0:
+            raise ValueError("id must be a non-negative integer when provided")
+        rec["id"] = int(doc["id"])
+    return rec
+
+
+def is_jsonl_input(fh: IO[bytes], name: str) -> bool:
+    # .jsonl/.ndjson files are JSONL and .yaml/.yml files are YAML. Otherwise (stdin, other
+    # names) it is JSONL only when the first line parses as JSON: a YAML flow mapping such
+    # as {metadata: {a: 1}, body: x} also starts with "{".
+    suffix = Path(name).suffix.lower()
+    if suffix in (".jsonl", ".ndjson"):
+        return True
+    if suffix in (".yaml", ".yml"):
+        return False
+    head = fh.peek(1 << 16) if hasattr(fh, "peek") else b""
+    first = head.lstrip().split(b"\n", 1)
+    if first[0][:1] != b"{":
+        return False
+    if len(first) == 1:
+        # First line longer than the peeked buffer: JSON object keys are double-quoted.
+        return first[0][1:].lstrip()[:1] in (b'"', b"}")
+    try:
+        json.loads(first[0])
+    except ValueError:
+        return False
+    return True
 
-        rec: dict[str, Any] = {"body": body, "metadata": metadata}
-        if "id" in doc:
-            if not isinstance(doc["id"], int) or doc["id"] < 0:
-                raise ValueError("id must be a non-negative integer when provided")
-            rec["id"] = int(doc["id"])
-        entries.append(rec)
 
-    if not entries:
-        raise ValueError("input YAML contains no entries")
-    return entries
+def iter_save_docs(fh: IO[bytes], name: str) -> Iterator[Any]:
+    jsonl = is_jsonl_input(fh, name)
+    text = io.TextIOWrapper(fh, encoding="utf-8")
+    try:
+        if not jsonl:
+            yield from yaml.safe_load_all(text)
+            return
+        for n, line in enumerate(text, 1):
+            if line.strip():
+                try:
+                    yield json.loads(line)
+                except ValueError as e:
+                    raise ValueError(f"line {n} is not valid JSON: {e}") from e
+    finally:
+        text.detach()  # leaves fh (possibly stdin) open for the caller
 
 
 def command_save(db_base: str, save_yaml_path: str, user_cwd: str, verbose: bool) -> int:
-    index_path, yaml_path = build_db_paths(db_base, user_cwd)
-    entries = parse_save_yaml_file(Path(save_yaml_path))
+    paths = build_db_paths(db_base, user_cwd)
+    if save_yaml_path != "-" and not Path(save_yaml_path).is_file():
+        print(f"Error: failed to read input file '{save_yaml_path}'", file=sys.stderr)
+        return 1
+
+    saved = 0
+    batch: list[dict[str, Any]] = []
+    with open(save_yaml_path, "rb") if save_yaml_path != "-" else nullcontext(sys.stdin.buffer) as fh:
+        try:
+            started = time.perf_counter()
+            for doc in iter_save_docs(fh, save_yaml_path):
+                entry = save_entry_from_doc(doc)
+                if entry is not None:
+                    batch.append(entry)
+                if len(batch) < SAVE_STREAM_BATCH:
+                    continue
+                PROFILE.add_time("parse", time.perf_counter() - started)
+                # A batch alone fills the delta, so it is merged once at the end of the stream.
+                rc = save_batch(paths, batch, verbose, merge=False)
+                if rc != 0:
+                    return rc
+                saved += len(batch)
+                batch = []
+                started = time.perf_counter()
+            PROFILE.add_time("parse", time.perf_counter() - started)
+        except (ValueError, yaml.YAMLError) as e:
+            done = f" ({saved} records were saved before it)" if saved else ""
+            print(f"Error: invalid save input: {e}{done}", file=sys.stderr)
+            return 1
+
+    if not batch and saved == 0:
+        print("Error: invalid save input: input contains no entries", file=sys.stderr)
+        return 1
+    if saved == 0:
+        return save_batch(paths, batch, verbose)
+    rc = save_batch(paths, batch, verbose, merge=False) if batch else 0
+    return rc if rc != 0 else merge_saved_delta(paths, verbose)
+
+
+def save_batch(paths: DbPaths, entries: list[dict[str, Any]], verbose: bool, merge: bool = True) -> int:
+    # The lock is taken per batch, so other writers can interleave with a long import.
+    with db_lock(paths):
+        try:
+            config = load_db_config(paths)
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+        if config["shards"] > 1:
+            return save_sharded(paths, config, entries, verbose, merge)
+        return save_entries(paths, entries, verbose, merge=merge)
 
+
+def merge_saved_delta(paths: DbPaths, verbose: bool) -> int:
+    with db_lock(paths):
+        try:
+            config = load_db_config(paths)
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+        for shard in shard_paths(paths, config):
+            with db_lock(shard):
+                if merge_full_delta(shard, verbose) != 0:
+                    return 1
+    return 0
+
+
+def save_sharded(
+    paths: DbPaths, config: dict[str, Any], entries: list[dict[str, Any]], verbose: bool, merge: bool = True
+) -> int:
+    shards = shard_paths(paths, config)
+    n = len(shards)
+    shard_key = config["shard_key"]
     try:
-        texts, metas = load_yaml_tables(yaml_path)
+        stores = [open_record_store(shard, verbose) for shard in shards]
+    except Exception as e:
+        print(f"Error: failed to load database shards of '{paths.stem}': {e}", file=sys.stderr)
+        return 1
+
+    # Route and validate everything before any shard is written.
+    routed: list[list[dict[str, Any]]] = [[] for _ in shards]
+    next_local = [store.count for store in stores]
+    memorized: list[tuple[str, int]] = []
+    for entry in entries:
+        metadata = entry.get("metadata") or {}
+        keyed = shard_key is not None and shard_key in metadata
+        if keyed and isinstance(metadata[shard_key], list):
+            print(f"Error: shard key '{shard_key}' must be a scalar, not a list", file=sys.stderr)
+            return 1
+        global_id = entry.get("id")
+        if global_id is None:
+            shard = shard_for_value(metadata[shard_key], n) if keyed else next_local.index(min(next_local))
+            local_id = next_local[shard]
+            next_local[shard] += 1
+        else:
+            shard, local_id = global_id % n, global_id // n
+            pending = local_id >= stores[shard].count
+            if local_id >= next_local[shard] or (not pending and stores[shard].is_blank(local_id)):
+                print(f"Error: override id {global_id} does not exist", file=sys.stderr)
+                return 1
+            if keyed and shard_for_value(metadata[shard_key], n) != shard:
+                print(
+                    f"Error: override id {global_id} would move to another shard by '{shard_key}'; "
+                    "save it as a new record instead",
+                    file=sys.stderr,
+                )
+                return 1
+        routed[shard].append({**entry, "id": None if global_id is None else local_id})
+        memorized.append((entry["body"], local_id * n + shard))
+
+    for shard, shard_entries in zip(shards, routed):
+        if not shard_entries:
+            continue
+        with db_lock(shard):
+            rc = save_entries(shard, shard_entries, verbose, quiet=True, merge=merge)
+        if rc != 0:
+            return rc
+    for note, global_id in memorized:
+        print(f"Memorized: '{note}' (ID: {global_id})")
+    return 0
+
+
+def save_entries(
+    paths: DbPaths, entries: list[dict[str, Any]], verbose: bool, quiet: bool = False, merge: bool = True
+) -> int:
+    index_path, yaml_path = paths.index, paths.yaml
+
+    try:
+        config = load_db_config(paths)
+        with PROFILE.phase("load_store"):
+            store = open_record_store(paths, verbose)
     except Exception as e:
         print(f"Error: failed to load database YAML '{yaml_path}': {e}", file=sys.stderr)
         return 1
+    try:
+        cache = EmbedCache(paths.ecache, get_embedder(config["embedder"]))
+    except ValueError as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
 
-    if len(metas) < len(texts):
-        metas.extend([None] * (len(texts) - len(metas)))
+    # An override may also name an id appended earlier in this same batch.
+    pending = store.count
+    for entry in entries:
+        override_id = entry.get("id")
+        if override_id is None:
+            pending += 1
+        elif override_id >= pending or (override_id < store.count and store.is_blank(override_id)):
+            print(f"Error: override id {override_id} does not exist", file=sys.stderr)
+            return 1
 
-    index = load_index(index_path, verbose)
-    existing_ids = get_existing_ids(index)
-    had_overwrite = False
+    ensure_parent_dir(index_path)
+    ensure_parent_dir(yaml_path)
 
+    # Everything is appended: new YAML documents (an overwrite is a later document
+    # with the same id), heap entries and delta vectors. Overwritten records get a
+    # new vector version; their old vector stays behind, listed in <base>.tomb.
+    appended: list[HeapRecord] = []
+    replaced: dict[int, HeapRecord] = {}
+    yaml_docs: list[tuple[int, str, dict[str, Any] | None]] = []
+    labels: list[int] = []
+    dead: list[int] = []
+    next_id = store.count
     for entry in entries:
         note = entry["body"]
         metadata = entry.get("metadata")
+        doc_id = entry.get("id")
+        if doc_id is None:
+            doc_id = next_id
+            next_id += 1
+            version = 0
+            appended.append((note, metadata, version))
+        elif doc_id >= store.count:
+            old_version = appended[doc_id - store.count][2]
+            dead.append(make_label(doc_id, old_version))
+            version = old_version + 1
+            appended[doc_id - store.count] = (note, metadata, version)
+        else:
+            previous = replaced.get(doc_id)
+            old_version = previous[2] if previous is not None else store.vec_version(doc_id)
+            dead.append(make_label(doc_id, old_version))
+            version = old_version + 1
+            replaced[doc_id] = (note, metadata, version)
+        labels.append(make_label(doc_id, version))
+        if is_deleted_record(metadata, note):
+            dead.append(labels[-1])
+        yaml_docs.append((doc_id, note, metadata))
+        if not quiet:
+            print(f"Memorized: '{note}' (ID: {doc_id})")
+
+    # Sidecar patches only need the changed ids' old metadata and bodies, captured
+    # first from the rows of the pre-save .rix.
+    old_metas = {doc_id: store.metadata(doc_id) for doc_id in replaced}
+    old_bodies = {
+        doc_id: store.body(doc_id) for doc_id in replaced if not store.is_blank(doc_id) and not store.is_deleted(doc_id)
+    }
+
+    with PROFILE.phase("embed"):
+        vecs = cache.embed([entry["body"] for entry in entries])
+    with PROFILE.phase("write"):
+        if not paths.tomb.exists():
+            write_tombstones(paths.tomb, scan_tombstones(paths, store, verbose) if store.count > 0 else [])
+        append_tombstones(paths.tomb, dead)
+        cache.append()
+        delta_rows = append_delta(paths.delta, np.array(labels, dtype=np.int64), vecs)
+        append_yaml_records(yaml_path, yaml_docs)
+        if store.count == 0:
+            write_record_store(
+                paths, [r[0] for r in appended], [r[1] for r in appended], store.generation + 1, [r[2] for r in appended]
+            )
+        else:
+            update_record_store(paths, store, appended, replaced)
 
-        override_id = entry.get("id")
-        if override_id is not None:
-            if override_id >= len(texts) or override_id not in existing_ids:
-                print(f"Error: override id {override_id} does not exist", file=sys.stderr)
-                return 1
+        changes: list[MetadataChange] = [(doc_id, old_metas[doc_id], metadata) for doc_id, (_, metadata, _) in replaced.items()]
+        changes += [(store.count + offset, None, metadata) for offset, (_, metadata, _) in enumerate(appended)]
+        append_metadata_patch(paths, config["indexed_keys"], changes, store.generation + 1)
 
-            texts[override_id] = note
-            metas[override_id] = metadata
-            had_overwrite = True
-            print(f"Memorized: '{note}' (ID: {override_id})")
-        else:
-            new_id = len(texts)
-            vec = embed_text_hash(note)
-            index.add_with_ids(vec.reshape(1, -1), np.array([new_id], dtype=np.int64))
-            texts.append(note)
-            metas.append(metadata)
-            print(f"Memorized: '{note}' (ID: {new_id})")
+        lexed = list(replaced.items()) + [(store.count + offset, row) for offset, row in enumerate(appended)]
+        added = [
+            (doc_id, note) for doc_id, (note, metadata, _) in lexed if not is_blank_body(note) and not is_deleted_record(metadata, note)
+        ]
+        append_lexical_patch(paths, old_bodies, added, store.generation + 1)
+    PROFILE.count("records_written", len(entries))
 
-    if had_overwrite:
-        index = rebuild_index_from_texts(texts, verbose)
+    if merge and delta_rows >= DELTA_MERGE_ROWS and merge_full_delta(paths, verbose) != 0:
+        return 1
+    if dead:
+        maybe_start_compaction(paths, config, verbose)
+    return 0
 
-    ensure_parent_dir(index_path)
-    ensure_parent_dir(yaml_path)
 
-    faiss.write_index(index, str(index_path))
-    save_yaml_tables(yaml_path, texts, metas)
+def merge_full_delta(paths: DbPaths, verbose: bool) -> int:
+    delta_rows = paths.delta.stat().st_size // delta_dtype().itemsize if paths.delta.exists() else 0
+    if delta_rows < DELTA_MERGE_ROWS:
+        return 0
+    try:
+        with PROFILE.phase("merge"):
+            merge_delta(paths, verbose)
+    except ValueError as e:
+        # The records are saved and recall still reads them from the delta.
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
     return 0
 
 
+def maybe_start_compaction(paths: DbPaths, config: dict[str, Any], verbose: bool) -> None:
+    # The tomb file size over-counts repeated labels, which only makes this fire early.
+    ratio = config["compact_ratio"]
+    dead = paths.tomb.stat().st_size // 8 if paths.tomb.exists() else 0
+    if not ratio or dead < COMPACT_MIN_DEAD:
+        return
+    delta_rows = paths.delta.stat().st_size // delta_dtype().itemsize if paths.delta.exists() else 0
+    stored = index_file_ntotal(paths.index) + delta_rows
+    if dead < ratio * stored:
+        return
+    with file_lock(paths.compact_lock, blocking=False) as idle:
+        if not idle:
+            return  # a compaction is already running
+    subprocess.Popen(
+        [sys.executable, str(Path(__file__).resolve()), "-f", str(paths.index), "compact"],
+        stdin=subprocess.DEVNULL,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+        start_new_session=True,
+        env={**os.environ, "MEMO_NO_SERVER": "1"},
+    )
+    vlog(verbose, f"Started background compaction of {paths.index.name} ({dead}/{stored} vectors dead)")
+
+
+def command_compact(db_base: str, user_cwd: str, verbose: bool) -> int:
+    paths = build_db_paths(db_base, user_cwd)
+    try:
+        config = load_db_config(paths)
+    except ValueError as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
+    for shard in shard_paths(paths, config):
+        with file_lock(shard.compact_lock, blocking=False) as idle:
+            if not idle:
+                print(f"Compaction of {shard.index.name} is already running")
+                continue
+            rc = compact_files(shard, verbose)
+        if rc != 0:
+            return rc
+    return 0
+
+
+def body_vectors(
+    paths: DbPaths,
+    index: faiss.IndexIDMap2,
+    config: dict[str, Any],
+    verbose: bool,
+) -> Callable[[np.ndarray], np.ndarray]:
+    # Row positions of `index` -> vectors embedded from the records' bodies (via <base>.ecache).
+    store = open_record_store(paths, verbose)
+    cache = EmbedCache(paths.ecache, get_embedder(config["embedder"]))
+    labels = faiss.vector_to_array(index.id_map).astype(np.int64)
+
+    def vectors(rows: np.ndarray) -> np.ndarray:
+        return cache.embed([store.body(label_doc_id(label)) for label in labels[rows].tolist()])
+
+    return vectors
+
+
+def compact_files(paths: DbPaths, verbose: bool) -> int:
+    # Only the snapshot and the final swap hold the writer lock: saves and recalls go
+    # on while the index is rebuilt. A merge or reindex in the meantime wins.
+    with db_lock(paths):
+        stamp = file_stamp(paths.index, paths.ivfdata)
+        dead = read_tombstones(paths.tomb)
+        try:
+            config = load_db_config(paths)
+            index = load_index(paths.index, verbose, FLAT_INDEX_SPEC)
+            # Decoding lossy codes and encoding them again would stack the quantization
+            # error on every compaction, so those indexes are rebuilt from the bodies.
+            vectors = body_vectors(paths, index, config, verbose) if is_quantized_index(index) else None
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+
+    labels = faiss.vector_to_array(index.id_map).astype(np.int64)
+    keep = ~np.isin(labels, dead)
+    removed = len(labels) - int(keep.sum())
+    rebuilt = index
+    if removed > 0:
+        started = time.perf_counter()
+        try:
+            with PROFILE.phase("rebuild"):
+                rebuilt = rebuild_from_vectors(index, keep, index_spec_for(config, int(keep.sum())), verbose, config, vectors)
+        except (ValueError, RuntimeError) as e:
+            print(f"Error: cannot compact {paths.index.name}: {e}", file=sys.stderr)
+            return 1
+        vlog(verbose, f"Timing: rebuild {time.perf_counter() - started:.3f}s ({int(keep.sum())} live vectors)")
+
+    with db_lock(paths), PROFILE.phase("write"):
+        if file_stamp(paths.index, paths.ivfdata) != stamp:
+            print(f"Skipped compaction: {paths.index.name} changed while it was rebuilt")
+            return 0
+        if removed > 0:
+            write_index_files(rebuilt, paths, store_invlists_ondisk(rebuilt, paths))
+        # The delta is small and only appended under this lock, so it is compacted in place.
+        delta_labels, delta_vecs = read_delta(paths.delta)
+        live = ~np.isin(delta_labels, read_tombstones(paths.tomb))
+        if not live.all():
+            with atomic_write(paths.delta) as fh:
+                fh.write(pack_delta(delta_labels[live], delta_vecs[live]))
+        prune_tombstones(paths, faiss.vector_to_array(rebuilt.id_map).astype(np.int64))
+    print(f"Compacted {paths.index.name}: dropped {removed + int((~live).sum())} dead vectors")
+    return 0
+
+
+@dataclass
+class RecallQuery:
+    query: str
+    k: int
+    filter_expr: str | None
+
+
+def clamp_k(k: int) -> int:
+    return max(1, min(k, MAX_K))
+
+
+def parse_recall_batch(text: str, default_k: int, default_filter: str | None) -> list[RecallQuery]:
+    # JSONL when every non-empty line is a JSON value, otherwise YAML documents.
+    # Each entry is a query string or a mapping {query, k?, filter?}.
+    lines = [ln for ln in text.splitlines() if ln.strip()]
+    try:
+        docs = [json.loads(ln) for ln in lines]
+    except ValueError:
+        docs = [doc for doc in yaml.safe_load_all(text) if doc is not None]
+
+    queries: list[RecallQuery] = []
+    for doc in docs:
+        if isinstance(doc, str):
+            doc = {"query": doc}
+        if not isinstance(doc, dict) or not isinstance(doc.get("query"), str) or not doc["query"].strip():
+            raise ValueError("each batch entry must be a query string or a mapping with a non-empty 'query'")
+        k = doc.get("k", default_k)
+        if not isinstance(k, int):
+            raise ValueError("batch entry 'k' must be an integer")
+        filter_expr = doc.get("filter", default_filter)
+        if isinstance(filter_expr, dict):
+            filter_expr = json.dumps(filter_expr, default=str)
+        if filter_expr is not None and not isinstance(filter_expr, str):
+            raise ValueError("batch entry 'filter' must be a filter expression or mapping")
+        queries.append(RecallQuery(doc["query"].strip(), clamp_k(k), filter_expr))
+    return queries
+
+
+Hit = tuple[int, float, str]  # global id, score, body
+
+
+def recall_yaml_results(hits: list[Hit], sources: list[str] | None = None) -> list[dict[str, Any]]:
+    if sources is None:
+        return [{"id": doc_id, "score": float(score), "body": LiteralString(body)} for doc_id, score, body in hits]
+    return [
+        {"base": base, "id": doc_id, "score": float(score), "body": LiteralString(body)}
+        for base, (doc_id, score, body) in zip(sources, hits)
+    ]
+
+
+def recall_shard(
+    paths: DbPaths,
+    shard: int,
+    shards: int,
+    queries: list[RecallQuery],
+    query_mat: np.ndarray | None,
+    active_filters: dict[str, dict[str, Any]],
+    allowed: list[bool],
+    tuning: SearchTuning,
+    mode: str = "vector",
+) -> tuple[list[list[Hit]], bool]:
+    # Returns hits per query (global ids) and whether higher scores are better.
+    # BM25 and fused (RRF) scores are always higher-is-better.
+    with PROFILE.phase("load_store"):
+        store = open_record_store(paths, verbose=False)
+    index: MemoIndex | None = None
+    similarity = True
+    if mode != "lexical":
+        with PROFILE.phase("load_index"):
+            index = open_vector_index(paths, verbose=False)
+        if mode == "vector":
+            similarity = is_similarity_metric(index.metric_type)
+    out: list[list[Hit]] = [[] for _ in queries]
+    rows = [row for row, ok in enumerate(allowed) if ok]
+    if len(store) == 0 or (index is not None and index.ntotal == 0) or not rows:
+        return out, similarity
+
+    config = load_db_config(paths)
+    used = {queries[row].filter_expr for row in rows} - {None}
+    candidates_by_filter: dict[str, list[int]] = {}
+    if used:
+        with PROFILE.phase("filter"):
+            midx = open_metadata_index(paths, store, config["indexed_keys"], verbose=False)
+            candidates_by_filter = {expr: filter_candidate_ids(store, midx, active_filters[expr]) for expr in used}
+    lex: dict[str, Any] | None = None
+    if mode != "vector":
+        with PROFILE.phase("load_lexical"):
+            lex = open_lexical_index(paths, store, verbose=False)
+    ks = [queries[row].k for row in rows]
+    cands = [candidates_by_filter[queries[row].filter_expr] if queries[row].filter_expr is not None else None for row in rows]
+    with PROFILE.phase("search"):
+        if mode == "lexical":
+            results = [bm25_search(lex, queries[row].query, k, c) for row, k, c in zip(rows, ks, cands)]
+        else:
+            # Hybrid fuses, and float re-ranking re-scores, the top k * overfetch.
+            rerank = config["rerank"] and index.quantized
+            depths = ks if mode == "vector" and not rerank else [k * tuning.overfetch for k in ks]
+            vector = collect_recall_batch(index, query_mat[rows], depths, store, cands, tuning)
+            if rerank:
+                embedder = get_embedder(config["embedder"])
+                cache = warm(f"ecache:{paths.ecache}", file_stamp(paths.ecache), lambda: EmbedCache(paths.ecache, embedder))
+                metric = is_similarity_metric(index.metric_type)
+                vector = [
+                    rerank_results(hits, query_mat[row], store, cache, metric, k if mode == "vector" else depth)
+                    for row, k, depth, hits in zip(rows, ks, depths, vector)
+                ]
+        if mode == "vector":
+            results = vector
+        elif mode == "hybrid":
+            results = [
+                fuse_rrf([vec, bm25_search(lex, queries[row].query, depth, c)], k)
+                for row, k, depth, c, vec in zip(rows, ks, depths, cands, vector)
+            ]
+        for row, hits in zip(rows, results):
+            out[row] = [(r.doc_id * shards + shard, r.score, store.body(r.doc_id)) for r in hits]
+    return out, similarity
+
+
 def command_recall(
-    db_base: str,
-    query: str,
+    db_bases: list[str],
+    query: str | None,
     k: int,
     filter_expr: str | None,
     as_yaml: bool,
     user_cwd: str,
+    batch_path: str | None = None,
+    tuning: SearchTuning | None = None,
+    mode: str = "vector",
+    as_jsonl: bool = False,
 ) -> int:
-    index_path, yaml_path = build_db_paths(db_base, user_cwd)
-
-    try:
-        texts, metas = load_yaml_tables(yaml_path)
-    except Exception as e:
-        print(f"Error: failed to load database YAML '{yaml_path}': {e}", file=sys.stderr)
-        return 1
+    tuning = tuning or SearchTuning()
 
-    index = load_index(index_path, verbose=False)
-
-    if not as_yaml:
-        print(f"Top {k} results:")
-    if index.ntotal == 0:
-        if as_yaml:
-            print(yaml.safe_dump({"results": []}, sort_keys=False).strip())
-        return 0
-
-    query_vec = embed_text_hash(query)
-    all_results = search_all(index, query_vec)
+    if batch_path is not None:
+        try:
+            batch_text = sys.stdin.read() if batch_path == "-" else Path(batch_path).read_text(encoding="utf-8")
+            queries = parse_recall_batch(batch_text, k, filter_expr)
+        except Exception as e:
+            print(f"Error: failed to read recall batch '{batch_path}': {e}", file=sys.stderr)
+            return 1
+    else:
+        queries = [RecallQuery(query or "", k, filter_expr)]
 
-    active_filter: dict[str, Any] | None = None
-    if filter_expr is not None:
+    active_filters: dict[str, dict[str, Any]] = {}
+    for q in queries:
+        if q.filter_expr is None or q.filter_expr in active_filters:
+            continue
         try:
-            active_filter = parse_yaml_flow_map(filter_expr)
+            active_filters[q.filter_expr] = parse_yaml_flow_map(q.filter_expr)
         except Exception as e:
             print(f"Error: invalid --filter expression: {e}", file=sys.stderr)
             return 1
 
-    shown = 0
-    yaml_results: list[dict[str, Any]] = []
-    for result in all_results:
-        if shown >= k:
-            break
-        if result.score < -0.9:
-            continue
+    def run(db_base: str) -> tuple[list[list[Hit]], bool]:
+        return recall_base(db_base, user_cwd, queries, active_filters, tuning, mode)
 
-        doc_id = result.doc_id
-        if doc_id < 0 or doc_id >= len(texts):
-            continue
+    if len(db_bases) > 1 and mode != "lexical":
+        # Vector scores are only comparable between bases that embed the same way.
+        try:
+            embedders = {base: load_db_config(build_db_paths(base, user_cwd))["embedder"] for base in db_bases}
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+        if len(set(embedders.values())) > 1:
+            listed = ", ".join(f"{base}: {name}" for base, name in embedders.items())
+            print(f"Error: cannot merge recall results from bases with different embedders ({listed})", file=sys.stderr)
+            return 1
 
-        if active_filter is not None:
-            record = metas[doc_id] if doc_id < len(metas) and metas[doc_id] is not None else {}
-            if not record:
-                continue
-            if not matches_filter(record, active_filter):
-                continue
+    ensure_loaded(faiss, np)
 
-        text = texts[doc_id] or ""
-        if is_blank_body(text):
-            continue
-        if as_yaml:
-            yaml_results.append(
-                {
-                    "id": doc_id,
-                    "score": float(result.score),
-                    "body": LiteralString(text),
-                }
-            )
+    try:
+        if len(db_bases) == 1:
+            per_base = [run(db_bases[0])]
         else:
-            print_recall_result_multiline(doc_id, result.score, text)
-        shown += 1
+            with ThreadPoolExecutor(max_workers=min(len(db_bases), os.cpu_count() or 1)) as pool:
+                per_base = list(pool.map(run, db_bases))
+    except ValueError as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
 
-    if as_yaml:
-        print(yaml.safe_dump({"results": yaml_results}, sort_keys=False).strip())
+    if len(db_bases) == 1:
+        with PROFILE.phase("output"):
+            print_recall_output(queries, per_base[0][0], k, as_yaml, batch_path is not None, as_jsonl=as_jsonl)
+        return 0
 
+    # Several bases: one top-k per query, each hit tagged with its base. Vector hits are
+    # merged by score; BM25 and RRF scores depend on each base's corpus, so lexical and
+    # hybrid hits are merged by rank (RRF over the per-base lists) instead.
+    if len({similarity for _, similarity in per_base}) > 1:
+        print("Error: cannot merge recall results from bases that score by similarity and by distance", file=sys.stderr)
+        return 1
+    similarity = per_base[0][1]
+    all_hits: list[list[Hit]] = []
+    sources: list[list[str]] = []
+    for row, q in enumerate(queries):
+        tagged = [(base, hit) for base, (hits, _) in zip(db_bases, per_base) for hit in hits[row]]
+        if mode == "vector":
+            tagged.sort(key=lambda item: -item[1][1] if similarity else item[1][1])
+            tagged = tagged[: q.k]
+        else:
+            # Results carry positions in tagged, which is grouped by base in rank order.
+            rankings: list[list[Result]] = []
+            for hits, _ in per_base:
+                start = sum(len(ranking) for ranking in rankings)
+                rankings.append([Result(start + rank, 0.0) for rank in range(len(hits[row]))])
+            fused = fuse_rrf(rankings, q.k)
+            tagged = [(tagged[r.doc_id][0], (tagged[r.doc_id][1][0], r.score, tagged[r.doc_id][1][2])) for r in fused]
+        all_hits.append([hit for _, hit in tagged])
+        sources.append([base for base, _ in tagged])
+    with PROFILE.phase("output"):
+        print_recall_output(queries, all_hits, k, as_yaml, batch_path is not None, sources, as_jsonl)
     return 0
 
 
+def recall_base(
+    db_base: str,
+    user_cwd: str,
+    queries: list[RecallQuery],
+    active_filters: dict[str, dict[str, Any]],
+    tuning: SearchTuning,
+    mode: str,
+) -> tuple[list[list[Hit]], bool]:
+    # Hits per query for one -f base and whether higher scores are better.
+    # Errors are raised as ValueError carrying the message to print.
+    paths = build_db_paths(db_base, user_cwd)
+    try:
+        config = load_db_config(paths)
+        shards = shard_paths(paths, config)
+        with PROFILE.phase("load_store"):
+            stores = [open_record_store(shard, verbose=False) for shard in shards]
+    except Exception as e:
+        raise ValueError(f"failed to load database YAML '{paths.yaml}': {e}") from e
+
+    # Served recalls answer repeated queries from RESULT_CACHE; the key carries each
+    # shard's generation and index file stamps, so a save, merge or reindex retires it.
+    state = tuple((store.generation, file_stamp(shard.index, shard.delta, shard.tomb)) for shard, store in zip(shards, stores))
+    keys = [recall_cache_key(paths, q, active_filters, tuning, mode, state) for q in queries]
+    cached: list[tuple[list[Hit], bool] | None] = [RESULT_CACHE.get(key) if RESULT_CACHE is not None else None for key in keys]
+    misses = [row for row, entry in enumerate(cached) if entry is None]
+    PROFILE.count("cache_hits", len(queries) - len(misses))
+    if misses:
+        found, similarity = search_queries(shards, config, [queries[row] for row in misses], active_filters, tuning, mode)
+        for row, hits in zip(misses, found):
+            cached[row] = (hits, similarity)
+            if RESULT_CACHE is not None:
+                RESULT_CACHE.put(keys[row], cached[row])
+    entries = [entry for entry in cached if entry is not None]
+    return [hits for hits, _ in entries], entries[0][1] if entries else True
+
+
+def search_queries(
+    shards: list[DbPaths],
+    config: dict[str, Any],
+    queries: list[RecallQuery],
+    active_filters: dict[str, dict[str, Any]],
+    tuning: SearchTuning,
+    mode: str = "vector",
+) -> tuple[list[list[Hit]], bool]:
+    n = len(shards)
+    pinned = [
+        filter_shards(active_filters[q.filter_expr], config["shard_key"], n) if q.filter_expr is not None else None
+        for q in queries
+    ]
+    query_mat: np.ndarray | None = None
+    if mode != "lexical":
+        with PROFILE.phase("embed"):
+            query_mat = get_embedder(config["embedder"]).embed([q.query for q in queries])
+    PROFILE.count("queries", len(queries))
+
+    def run(shard: int) -> tuple[list[list[Hit]], bool]:
+        allowed = [p is None or shard in p for p in pinned]
+        return recall_shard(shards[shard], shard, n, queries, query_mat, active_filters, allowed, tuning, mode)
+
+    if n == 1:
+        per_shard = [run(0)]
+    else:
+        with ThreadPoolExecutor(max_workers=min(n, os.cpu_count() or 1)) as pool:
+            per_shard = list(pool.map(run, range(n)))
+    similarity = per_shard[0][1]
+    all_hits: list[list[Hit]] = []
+    for row, q in enumerate(queries):
+        merged = [hit for hits, _ in per_shard for hit in hits[row]]
+        if n > 1:
+            merged.sort(key=lambda hit: -hit[1] if similarity else hit[1])
+        all_hits.append(merged[: q.k])
+    return all_hits, similarity
+
+
+RECALL_CACHE_SIZE = 1024
+
+
+class ResultCache:
+    # LRU of recall hits and their score direction; only memo serve keeps one (see RESULT_CACHE).
+    def __init__(self, size: int = RECALL_CACHE_SIZE) -> None:
+        self.size = size
+        self.entries: OrderedDict[Any, tuple[list[Hit], bool]] = OrderedDict()
+        self.lock = threading.Lock()  # multi-base recalls look up from several threads
+
+    def get(self, key: Any) -> tuple[list[Hit], bool] | None:
+        with self.lock:
+            hits = self.entries.get(key)
+            if hits is not None:
+                self.entries.move_to_end(key)
+            return hits
+
+    def put(self, key: Any, hits: tuple[list[Hit], bool]) -> None:
+        with self.lock:
+            self.entries[key] = hits
+            self.entries.move_to_end(key)
+            while len(self.entries) > self.size:
+                self.entries.popitem(last=False)
+
+
+RESULT_CACHE: ResultCache | None = None
+
+
+def recall_cache_key(
+    paths: DbPaths,
+    q: RecallQuery,
+    active_filters: dict[str, dict[str, Any]],
+    tuning: SearchTuning,
+    mode: str,
+    state: Any,
+) -> Any:
+    # Filters are keyed by their parsed form, so "{a: 1}" and "a: 1" share an entry.
+    filt = json.dumps(active_filters[q.filter_expr], sort_keys=True, default=str) if q.filter_expr is not None else None
+    return (str(paths.stem), normalize_whitespace(q.query), q.k, filt, astuple(tuning), mode, state)
+
+
+def print_recall_output(
+    queries: list[RecallQuery],
+    all_hits: list[list[Hit]],
+    k: int,
+    as_yaml: bool,
+    batch: bool,
+    sources: list[list[str]] | None = None,
+    as_jsonl: bool = False,
+) -> None:
+    # sources, for multi-base recall, names the base of every hit.
+    tags = sources or [[None] * len(hits) for hits in all_hits]
+    if as_jsonl:
+        write_jsonl(
+            {**({"base": base} if base is not None else {}), "query": q.query, "id": doc_id, "score": float(score), "body": body}
+            for q, hits, bases in zip(queries, all_hits, tags)
+            for base, (doc_id, score, body) in zip(bases, hits)
+        )
+        return
+    if not batch:
+        if as_yaml:
+            print(literal_yaml().safe_dump({"results": recall_yaml_results(all_hits[0], sources and sources[0])}, sort_keys=False).strip())
+            return
+        print(f"Top {k} results:")
+        for base, (doc_id, score, body) in zip(tags[0], all_hits[0]):
+            print_recall_result_multiline(doc_id, score, body, base)
+        return
+
+    if as_yaml:
+        docs = [
+            {"query": q.query, "results": recall_yaml_results(hits, sources and sources[row])}
+            for row, (q, hits) in enumerate(zip(queries, all_hits))
+        ]
+        print(literal_yaml().safe_dump_all(docs, explicit_start=True, sort_keys=False).strip())
+        return
+    for q, hits, bases in zip(queries, all_hits, tags):
+        print(f"Top {q.k} results for '{q.query}':")
+        for base, (doc_id, score, body) in zip(bases, hits):
+            print_recall_result_multiline(doc_id, score, body, base)
+
+
 def parse_iso_datetime(value: Any) -> datetime | None:
     if not isinstance(value, str):
         return None
@@ -573,64 +3403,250 @@ def print_table(headers: list[str], rows: list[list[str]]) -> None:
         for idx, cell in enumerate(row):
             widths[idx] = max(widths[idx], len(cell))
 
-    print("  ".join(h.ljust(widths[i]) for i, h in enumerate(headers)))
+    lines = ["  ".join(h.ljust(widths[i]) for i, h in enumerate(headers))]
+    lines.extend("  ".join(cell.ljust(widths[i]) for i, cell in enumerate(row)) for row in rows)
+    sys.stdout.write("\n".join(lines) + "\n")
+
+
+JSONL_CHUNK = 4096
+
+
+def write_jsonl(rows: Iterable[dict[str, Any]]) -> None:
+    # One JSON object per line, written JSONL_CHUNK lines at a time (a terminal
+    # stdout is line-buffered, so per-line writes would each make a syscall).
+    chunk: list[str] = []
     for row in rows:
-        print("  ".join(cell.ljust(widths[i]) for i, cell in enumerate(row)))
+        chunk.append(json.dumps(row, ensure_ascii=False, default=str))
+        if len(chunk) >= JSONL_CHUNK:
+            sys.stdout.write("\n".join(chunk) + "\n")
+            chunk.clear()
+    if chunk:
+        sys.stdout.write("\n".join(chunk) + "\n")
+
+
+def stats_number(value: Any) -> float | None:
+    if isinstance(value, (int, float)):
+        return float(value)
+    try:
+        return float(str(value))
+    except (ValueError, TypeError):
+        return None
+
+
+# <base>.cols caches one typed column per --stats key, indexed by id, so stats are numpy
+# reductions over the matched ids:
+#   present      bool, key resolves to a non-None value
+#   codes        int32 dictionary code of format_cell(value) into labels
+#   numbers      float64 value (number_ok marks values that parse as a number)
+#   dates        datetime64[us] UTC instant of ISO date strings (NaT otherwise);
+#                date_codes index date_labels, the printed calendar date
+# Columns are built on first use. When the record-store generation moves they are
+# brought up to date instead of rebuilt: ids past the cached count are filled in, and
+# ids whose heap offset changed (an overwrite appends a new heap entry) are read again,
+# by comparing against the .rix offsets the columns were filled from. A new heap
+# (reindex, regeneration from YAML) starts over.
+# The file is an .npz (loaded with allow_pickle=False) holding those offsets, the
+# heap_id, and column i of the `keys` array as k<i>_<field>.
+COLS_VERSION = 3
+COLS_FIELDS = ("present", "codes", "labels", "numbers", "number_ok", "dates", "date_codes", "date_labels")
+COLS_LISTS = ("labels", "date_labels")
+
+
+def empty_stats_column(n: int) -> dict[str, Any]:
+    return {
+        "present": np.zeros(n, dtype=bool),
+        "codes": np.full(n, -1, dtype=np.int32),
+        "labels": [],
+        "numbers": np.full(n, np.nan),
+        "number_ok": np.zeros(n, dtype=bool),
+        "dates": np.full(n, np.datetime64("NaT"), dtype="datetime64[us]"),
+        "date_codes": np.full(n, -1, dtype=np.int32),
+        "date_labels": [],
+    }
+
+
+def grow_stats_column(column: dict[str, Any], n: int) -> dict[str, Any]:
+    # A copy with room for n ids; cached columns may be shared through WARM_CACHE.
+    grown = empty_stats_column(n)
+    for field in COLS_FIELDS:
+        if field in COLS_LISTS:
+            grown[field] = list(column[field])
+        else:
+            grown[field][: len(column[field])] = column[field]
+    return grown
+
+
+def fill_stats_column(column: dict[str, Any], store: RecordStore, key: str, ids: Iterable[int]) -> None:
+    labels = {label: code for code, label in enumerate(column["labels"])}
+    date_labels = {label: code for code, label in enumerate(column["date_labels"])}
+    for doc_id in ids:
+        column["present"][doc_id] = False
+        column["codes"][doc_id] = -1
+        column["numbers"][doc_id] = np.nan
+        column["number_ok"][doc_id] = False
+        column["dates"][doc_id] = np.datetime64("NaT")
+        column["date_codes"][doc_id] = -1
+        value = resolve_field_value(doc_id, store.metadata(doc_id) or {}, key)
+        if value is None:
+            continue
+        column["present"][doc_id] = True
+        column["codes"][doc_id] = labels.setdefault(format_cell(value), len(labels))
+        number = stats_number(value)
+        if number is not None:
+            column["numbers"][doc_id] = number
+            column["number_ok"][doc_id] = True
+        parsed = parse_iso_datetime(value)
+        if parsed is not None:
+            if parsed.tzinfo is not None:
+                parsed_utc = parsed.astimezone(timezone.utc).replace(tzinfo=None)
+            else:
+                parsed_utc = parsed
+            column["dates"][doc_id] = np.datetime64(parsed_utc, "us")
+            column["date_codes"][doc_id] = date_labels.setdefault(parsed.date().isoformat(), len(date_labels))
+    column["labels"] = list(labels)
+    column["date_labels"] = list(date_labels)
+
+
+def build_stats_column(store: RecordStore, key: str) -> dict[str, Any]:
+    column = empty_stats_column(len(store))
+    fill_stats_column(column, store, key, range(len(store)))
+    return column
+
+
+def load_stats_columns(path: Path) -> dict[str, Any] | None:
+    try:
+        with np.load(path, allow_pickle=False) as npz:
+            if int(npz["version"]) != COLS_VERSION:
+                return None
+            keys: dict[str, Any] = {}
+            for i, key in enumerate(npz["keys"].tolist()):
+                column = {field: npz[f"k{i}_{field}"] for field in COLS_FIELDS}
+                for field in COLS_LISTS:
+                    column[field] = column[field].tolist()
+                keys[key] = column
+            return {
+                "version": COLS_VERSION,
+                "generation": int(npz["generation"]),
+                "heap_id": int(npz["heap_id"]),
+                "offsets": npz["offsets"],
+                "keys": keys,
+            }
+    except (OSError, ValueError, KeyError, EOFError):
+        return None
+
+
+def save_stats_columns(path: Path, cached: dict[str, Any]) -> None:
+    arrays: dict[str, np.ndarray] = {
+        "version": np.array(cached["version"]),
+        "generation": np.array(cached["generation"]),
+        "heap_id": np.array(cached["heap_id"], dtype=np.uint64),
+        "offsets": cached["offsets"],
+        "keys": np.array(list(cached["keys"]), dtype=str),
+    }
+    for i, column in enumerate(cached["keys"].values()):
+        for field in COLS_FIELDS:
+            arrays[f"k{i}_{field}"] = np.array(column[field], dtype=str) if field in COLS_LISTS else column[field]
+    with atomic_write(path) as fh:
+        np.savez(fh, **arrays)
+
+
+def read_stats_column(paths: DbPaths, store: RecordStore, key: str) -> dict[str, Any]:
+    offsets = store.offset_array()
+    cached = load_stats_columns(paths.cols)
+    changed = cached is None or cached["generation"] != store.generation
+    if cached is None or cached["heap_id"] != store.heap_id or len(cached["offsets"]) > len(offsets):
+        cached = {"version": COLS_VERSION, "generation": store.generation, "heap_id": store.heap_id, "offsets": offsets, "keys": {}}
+    elif changed:
+        old = cached["offsets"]
+        stale = np.flatnonzero(old != offsets[: len(old)]).tolist() + list(range(len(old), len(offsets)))
+        for name, column in list(cached["keys"].items()):
+            column = grow_stats_column(column, len(offsets))
+            fill_stats_column(column, store, name, stale)
+            cached["keys"][name] = column
+        cached["generation"], cached["offsets"] = store.generation, offsets
+    if key not in cached["keys"]:
+        cached["keys"][key] = build_stats_column(store, key)
+        changed = True
+
+    if changed:
+        with db_lock(paths, blocking=False) as locked:
+            if locked and len(store) > 0 and store.generation == read_generation(paths):
+                save_stats_columns(paths.cols, cached)
+    return cached["keys"][key]
+
+
+def open_stats_column(paths: DbPaths, store: RecordStore, key: str) -> dict[str, Any]:
+    stamp = (file_stamp(paths.cols), store.generation)
+    return warm(f"cols:{paths.cols}:{key}", stamp, lambda: read_stats_column(paths, store, key))
+
+
+def select_stats(parts: list[tuple[dict[str, Any], np.ndarray, np.ndarray]]) -> dict[str, Any]:
+    # parts: (column, local ids, global ids) per shard. Returns the matched rows of
+    # every part in global id order, with codes remapped to shared dictionaries.
+    labels: dict[str, int] = {}
+    date_labels: dict[str, int] = {}
+    chunks: list[tuple[np.ndarray, ...]] = []
+    for column, local_ids, global_ids in parts:
+        keep = column["present"][local_ids]
+        local = local_ids[keep]
+        remap = np.array([labels.setdefault(v, len(labels)) for v in column["labels"]], dtype=np.int32)
+        # The trailing -1 keeps "not a date" (-1) codes at -1 after remapping.
+        date_remap = np.array(
+            [date_labels.setdefault(v, len(date_labels)) for v in column["date_labels"]] + [-1], dtype=np.int32
+        )
+        chunks.append(
+            (
+                global_ids[keep],
+                remap[column["codes"][local]],
+                column["numbers"][local],
+                column["number_ok"][local],
+                column["dates"][local],
+                date_remap[column["date_codes"][local]],
+            )
+        )
+    order = np.argsort(np.concatenate([c[0] for c in chunks]), kind="stable")
+    names = ("codes", "numbers", "number_ok", "dates", "date_codes")
+    out = {name: np.concatenate([c[i + 1] for c in chunks])[order] for i, name in enumerate(names)}
+    out["labels"] = list(labels)
+    out["date_labels"] = list(date_labels)
+    return out
 
 
-def print_stats(matches: list[tuple[int, dict[str, Any]]], key: str) -> None:
-    values: list[Any] = []
-    for doc_id, metadata in matches:
-        value = resolve_field_value(doc_id, metadata, key)
-        if value is not None:
-            values.append(value)
+def print_stats(sel: dict[str, Any], key: str) -> None:
+    codes = sel["codes"]
+    labels = sel["labels"]
 
-    counter: Counter[str] = Counter(format_cell(v) for v in values)
+    # Same order as Counter.most_common: count desc, then first appearance.
+    distinct, first = np.unique(codes, return_index=True)
+    counts = np.bincount(codes, minlength=len(labels))[distinct]
+    order = np.lexsort((first, -counts))
     print(f"Key: {key}")
-    print(f"Cardinality (distinct values): {len(counter)}")
+    print(f"Cardinality (distinct values): {len(distinct)}")
     print("Cardinality by value:")
-    top = counter.most_common(4)
-    for name, count in top:
-        print(f"  {name}: {count}")
-    if len(counter) > 4:
-        other = sum(counter.values()) - sum(c for _, c in top)
-        print(f"  other (aggregate of {len(counter) - 4} additional values): {other}")
-
-    if values:
-        numeric: list[float] = []
-        numeric_ok = True
-        for value in values:
-            if isinstance(value, (int, float)):
-                numeric.append(float(value))
-                continue
-            try:
-                numeric.append(float(str(value)))
-            except (ValueError, TypeError):
-                numeric_ok = False
-                break
-
-        if numeric_ok and numeric:
-            avg = sum(numeric) / len(numeric)
-            print("Range (numeric):")
-            print(f"  min: {min(numeric):g}")
-            print(f"  max: {max(numeric):g}")
-            print(f"  avg: {avg:.2f}")
-            return
+    top = order[:4]
+    for i in top:
+        print(f"  {labels[distinct[i]]}: {counts[i]}")
+    if len(distinct) > 4:
+        other = len(codes) - int(counts[top].sum())
+        print(f"  other (aggregate of {len(distinct) - 4} additional values): {other}")
+
+    if len(codes) == 0:
+        return
+    if sel["number_ok"].all():
+        numbers = sel["numbers"]
+        print("Range (numeric):")
+        print(f"  min: {float(numbers.min()):g}")
+        print(f"  max: {float(numbers.max()):g}")
+        print(f"  avg: {float(numbers.sum()) / len(numbers):.2f}")
+        return
 
-        dates: list[datetime] = []
-        date_ok = True
-        for value in values:
-            parsed = parse_iso_datetime(value)
-            if parsed is None:
-                date_ok = False
-                break
-            dates.append(parsed)
-        if date_ok and dates:
-            start = min(dates)
-            end = max(dates)
-            print("Range (date-like):")
-            print(f"  start: {start.date().isoformat()}")
-            print(f"  end:   {end.date().isoformat()}")
+    date_codes = sel["date_codes"]
+    if (date_codes >= 0).all():
+        dates = sel["dates"]
+        date_labels = sel["date_labels"]
+        print("Range (date-like):")
+        print(f"  start: {date_labels[date_codes[int(dates.argmin())]]}")
+        print(f"  end:   {date_labels[date_codes[int(dates.argmax())]]}")
 
 
 def command_analyze(
@@ -641,6 +3657,7 @@ def command_analyze(
     limit: int,
     offset: int,
     user_cwd: str,
+    as_jsonl: bool = False,
 ) -> int:
     if not filter_expr.strip():
         print("Error: analyze requires --filter <expr>", file=sys.stderr)
@@ -652,11 +3669,14 @@ def command_analyze(
         print("Error: --offset must be >= 0", file=sys.stderr)
         return 1
 
-    _, yaml_path = build_db_paths(db_base, user_cwd)
+    paths = build_db_paths(db_base, user_cwd)
     try:
-        texts, metas = load_yaml_tables(yaml_path)
+        config = load_db_config(paths)
+        shards = shard_paths(paths, config)
+        with PROFILE.phase("load_store"):
+            stores = [open_record_store(shard, verbose=False) for shard in shards]
     except Exception as e:
-        print(f"Error: failed to load database YAML '{yaml_path}': {e}", file=sys.stderr)
+        print(f"Error: failed to load database YAML '{paths.yaml}': {e}", file=sys.stderr)
         return 1
 
     try:
@@ -665,24 +3685,58 @@ def command_analyze(
         print(f"Error: invalid --filter expression: {e}", file=sys.stderr)
         return 1
 
-    matches: list[tuple[int, dict[str, Any]]] = []
-    for doc_id in range(len(texts)):
-        metadata = metas[doc_id] if doc_id < len(metas) and metas[doc_id] is not None else {}
-        if not metadata:
+    n = len(shards)
+    pinned = filter_shards(active_filter, config["shard_key"], n)
+    matched: list[tuple[int, list[int]]] = []
+    for shard, (shard_db, store) in enumerate(zip(shards, stores)):
+        if pinned is not None and shard not in pinned:
+            matched.append((shard, []))
             continue
-        if matches_filter(metadata, active_filter):
-            matches.append((doc_id, metadata))
+        with PROFILE.phase("filter"):
+            midx = open_metadata_index(shard_db, store, load_db_config(shard_db)["indexed_keys"], verbose=False)
+            matched.append((shard, select_ids(store, midx, active_filter)))
 
-    print(f"Matched: {len(matches)}")
+    if not as_jsonl:
+        print(f"Matched: {sum(len(ids) for _, ids in matched)}")
     if stats_key is not None:
-        print_stats(matches, stats_key)
+        with PROFILE.phase("stats"):
+            parts = []
+            for shard, ids in matched:
+                local = np.array(ids, dtype=np.int64)
+                parts.append((open_stats_column(shards[shard], stores[shard], stats_key), local, local * n + shard))
+            print_stats(select_stats(parts), stats_key)
         return 0
 
-    selected_fields = fields if fields else default_analyze_fields(matches)
-    if not selected_fields:
-        selected_fields = ["id"]
+    with PROFILE.phase("table"):
+        print_analyze_table(stores, n, matched, fields, limit, offset, as_jsonl)
+    return 0
+
+
+def print_analyze_table(
+    stores: list[RecordStore],
+    n: int,
+    matched: list[tuple[int, list[int]]],
+    fields: list[str] | None,
+    limit: int,
+    offset: int,
+    as_jsonl: bool = False,
+) -> None:
+    # Global id order; metadata is only read for the page unless default fields need every match.
+    gids = sorted(doc_id * n + shard for shard, ids in matched for doc_id in ids)
+
+    def with_metadata(window: list[int]) -> list[tuple[int, dict[str, Any]]]:
+        return [(gid, stores[gid % n].metadata(gid // n) or {}) for gid in window]
 
-    page = matches[offset : offset + limit]
+    if fields:
+        selected_fields = fields
+        page = with_metadata(gids[offset : offset + limit])
+    else:
+        matches = with_metadata(gids)
+        selected_fields = default_analyze_fields(matches) or ["id"]
+        page = matches[offset : offset + limit]
+    if as_jsonl:
+        write_jsonl({field: resolve_field_value(doc_id, metadata, field) for field in selected_fields} for doc_id, metadata in page)
+        return
     rows: list[list[str]] = []
     for doc_id, metadata in page:
         row = [format_cell(resolve_field_value(doc_id, metadata, field)) for field in selected_fields]
@@ -690,43 +3744,443 @@ def command_analyze(
 
     headers = ["ID" if field == "id" else field for field in selected_fields]
     print_table(headers, rows)
+
+
+# `memo bench` builds a synthetic store in a scratch database and times each command
+# in-process (no interpreter startup), writing JSON results that --compare can diff.
+BENCH_WORDS = 2000
+BENCH_VERSION = 1
+
+
+@dataclass
+class BenchOptions:
+    records: int = 10000
+    cardinality: int = 16
+    queries: int = 200
+    batch: int = 500
+    runs: int = 3
+    seed: int = 0
+    out: str = "bench_output.txt"
+    compare: str | None = None
+    keep: bool = False
+
+
+def bench_corpus(opts: BenchOptions) -> list[dict[str, Any]]:
+    rng = random.Random(opts.seed)
+    words = [f"w{i}" for i in range(BENCH_WORDS)]
+    values = [f"v{i}" for i in range(opts.cardinality)]
+    docs: list[dict[str, Any]] = []
+    for i in range(opts.records):
+        docs.append(
+            {
+                "metadata": {
+                    "source": f"src{rng.randrange(opts.cardinality)}",
+                    "tags": rng.sample(values, min(len(values), rng.randint(1, 3))),
+                    "priority": rng.randint(1, 5),
+                    "ts": f"2024-{rng.randint(1, 12):02d}-{rng.randint(1, 28):02d}T00:00:00Z",
+                },
+                "body": " ".join(rng.choices(words, k=rng.randint(8, 30))),
+            }
+        )
+    return docs
+
+
+def bench_summary(samples: list[float], items: int) -> dict[str, Any]:
+    ms = np.array(samples) * 1000.0
+    total = float(sum(samples))
+    return {
+        "runs": len(samples),
+        "p50_ms": round(float(np.percentile(ms, 50)), 3),
+        "p95_ms": round(float(np.percentile(ms, 95)), 3),
+        "p99_ms": round(float(np.percentile(ms, 99)), 3),
+        "mean_ms": round(float(ms.mean()), 3),
+        "throughput_per_s": round(items / total, 1) if total > 0 else None,
+    }
+
+
+def bench_environment() -> dict[str, Any]:
+    try:
+        commit = subprocess.run(
+            ["git", "rev-parse", "--short", "HEAD"],
+            cwd=str(Path(__file__).resolve().parent),
+            capture_output=True,
+            text=True,
+            timeout=5,
+        ).stdout.strip()
+    except (OSError, subprocess.SubprocessError):
+        commit = ""
+    return {
+        "commit": commit or None,
+        "python": platform.python_version(),
+        "faiss": getattr(faiss, "__version__", None),
+        "numpy": np.__version__,
+        "platform": platform.platform(),
+        "cpus": os.cpu_count(),
+    }
+
+
+def bench_run(argv: list[str], cwd: str) -> float:
+    # Output is discarded; a failing command aborts the benchmark.
+    sink = io.StringIO()
+    started = time.perf_counter()
+    with redirect_stdout(sink), redirect_stderr(sink):
+        rc = run_command(["memo", *argv], cwd)
+    elapsed = time.perf_counter() - started
+    if rc != 0:
+        raise RuntimeError(f"memo {' '.join(argv)} failed: {sink.getvalue().strip()}")
+    return elapsed
+
+
+def bench_process_run(argv: list[str], cwd: str) -> float:
+    # A fresh interpreter per run, so the time includes startup and imports.
+    env = dict(os.environ, MEMO_NO_SERVER="1")
+    started = time.perf_counter()
+    proc = subprocess.run([sys.executable, str(Path(__file__).resolve()), *argv], cwd=cwd, env=env, capture_output=True, text=True)
+    elapsed = time.perf_counter() - started
+    if proc.returncode != 0:
+        raise RuntimeError(f"memo {' '.join(argv)} failed: {proc.stderr.strip()}")
+    return elapsed
+
+
+def run_bench(base: str, workdir: str, opts: BenchOptions) -> dict[str, Any]:
+    rng = random.Random(opts.seed + 1)
+    docs = bench_corpus(opts)
+    words = [f"w{i}" for i in range(BENCH_WORDS)]
+    queries = [" ".join(rng.choices(words, k=rng.randint(2, 6))) for _ in range(opts.queries)]
+    sources = [f"src{rng.randrange(opts.cardinality)}" for _ in range(opts.queries)]
+    results: dict[str, Any] = {}
+
+    save_times: list[float] = []
+    batch_file = Path(workdir) / "bench_batch.yaml"
+    for start in range(0, len(docs), opts.batch):
+        batch_file.write_text(yaml.safe_dump_all(docs[start : start + opts.batch], sort_keys=False), encoding="utf-8")
+        save_times.append(bench_run(["-f", base, "save", str(batch_file)], workdir))
+    batch_file.unlink(missing_ok=True)
+    results["save"] = bench_summary(save_times, len(docs))
+
+    recall_times = [bench_run(["-f", base, "recall", "-k", "10", q], workdir) for q in queries]
+    results["recall"] = bench_summary(recall_times, len(queries))
+    filtered_times = [
+        bench_run(["-f", base, "recall", "-k", "10", "--filter", f"{{source: {src}}}", q], workdir)
+        for q, src in zip(queries, sources)
+    ]
+    results["recall_filter"] = bench_summary(filtered_times, len(queries))
+
+    stats_runs = max(1, opts.queries // 10)
+    for key in ("priority", "ts"):
+        stats_times = [bench_run(["-f", base, "analyze", "--filter", "{}", "--stats", key], workdir) for _ in range(stats_runs)]
+        results[f"analyze_stats_{key}"] = bench_summary(stats_times, stats_runs)
+
+    # Cold processes: --help is interpreter start plus module import; a small analyze
+    # table adds the record store but should never import FAISS.
+    startup_runs = max(3, opts.runs)
+    help_times = [bench_process_run(["--help"], workdir) for _ in range(startup_runs)]
+    results["startup_help"] = bench_summary(help_times, startup_runs)
+    analyze_argv = ["-f", base, "analyze", "--filter", "{source: src0}", "--limit", "10"]
+    analyze_times = [bench_process_run(analyze_argv, workdir) for _ in range(startup_runs)]
+    results["startup_analyze"] = bench_summary(analyze_times, startup_runs)
+
+    reindex_times = [bench_run(["-f", base, "reindex"], workdir) for _ in range(opts.runs)]
+    results["reindex"] = bench_summary(reindex_times, len(docs) * opts.runs)
+    return results
+
+
+def print_bench(report: dict[str, Any], baseline: dict[str, Any] | None) -> None:
+    headers = ["op", "runs", "p50_ms", "p95_ms", "p99_ms", "per_s"]
+    if baseline is not None:
+        headers.append("p50_vs_base")
+    rows: list[list[str]] = []
+    for op, r in report["results"].items():
+        row = [op, str(r["runs"]), f"{r['p50_ms']:.3f}", f"{r['p95_ms']:.3f}", f"{r['p99_ms']:.3f}", str(r["throughput_per_s"])]
+        if baseline is not None:
+            old = baseline.get("results", {}).get(op)
+            if old and old.get("p50_ms"):
+                row.append(f"{(r['p50_ms'] - old['p50_ms']) / old['p50_ms'] * 100:+.1f}%")
+            else:
+                row.append("-")
+        rows.append(row)
+    print_table(headers, rows)
+
+
+def command_bench(db_base: str, user_cwd: str, opts: BenchOptions) -> int:
+    paths = build_db_paths(db_base, user_cwd)
+    if any(p.exists() for p in paths.files()):
+        print(f"Error: bench needs an unused <base>; '{paths.stem}' already has database files", file=sys.stderr)
+        return 1
+    baseline: dict[str, Any] | None = None
+    if opts.compare is not None:
+        try:
+            baseline = json.loads((Path(user_cwd) / opts.compare).read_text(encoding="utf-8"))
+        except (OSError, ValueError) as e:
+            print(f"Error: failed to read --compare file '{opts.compare}': {e}", file=sys.stderr)
+            return 1
+
+    params = {k: v for k, v in vars(opts).items() if k not in ("out", "compare", "keep")}
+    with tempfile.TemporaryDirectory(prefix="memo-bench-") as workdir:
+        try:
+            results = run_bench(str(paths.stem), workdir, opts)
+        except RuntimeError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+        finally:
+            if not opts.keep:
+                with redirect_stdout(io.StringIO()):
+                    command_clean(str(paths.stem), user_cwd)
+
+    report = {"version": BENCH_VERSION, "params": params, "env": bench_environment(), "results": results}
+    out_path = Path(user_cwd) / opts.out
+    with atomic_write(out_path) as fh:
+        fh.write((json.dumps(report, indent=2) + "\n").encode("utf-8"))
+    print_bench(report, baseline)
+    print(f"Wrote results: {out_path}")
+    return 0
+
+
+# `memo serve` answers one JSON request per connection on <base>.sock:
+#   request:  {"argv": [...], "cwd": "..."}
+#   response: {"rc": int, "stdout": str, "stderr": str}
+# The CLI forwards these commands when it finds a live socket for its -f base.
+SERVED_COMMANDS = {"save", "recall", "analyze"}
+# Seconds. A server that does not accept, or does not answer, in time is bypassed and
+# the command runs locally; the server drops clients that stall sending their request.
+SERVER_CONNECT_TIMEOUT = 2.0
+SERVER_REPLY_TIMEOUT = 120.0
+SERVER_RECV_TIMEOUT = 5.0
+
+
+def reads_stdin(positional: list[str]) -> bool:
+    # `save -` and `recall --batch -`; a bare "-" inside a recall query is just a word.
+    if positional[0] == "save":
+        return positional[1:] == ["-"]
+    args = positional[1:]
+    return positional[0] == "recall" and any(arg == "--batch" and args[i + 1 : i + 2] == ["-"] for i, arg in enumerate(args))
+
+
+def forward_to_server(argv: list[str], user_cwd: str) -> int | None:
+    if os.environ.get("MEMO_NO_SERVER"):
+        return None
+    with redirect_stderr(io.StringIO()):
+        parsed, rc = parse_args(argv)
+    positional = parsed.get("positional") or []
+    if rc != 0 or parsed.get("db_base") is None or not positional or positional[0] not in SERVED_COMMANDS:
+        return None
+    if reads_stdin(positional):
+        return None  # stdin is not forwarded
+    sock_path = build_db_paths(parsed["db_base"], user_cwd).sock
+    if not sock_path.exists():
+        return None
+
+    sent = False
+    try:
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as conn:
+            conn.settimeout(SERVER_CONNECT_TIMEOUT)
+            conn.connect(str(sock_path))
+            conn.sendall(json.dumps({"argv": argv, "cwd": user_cwd}).encode("utf-8") + b"\n")
+            conn.shutdown(socket.SHUT_WR)
+            sent = True
+            conn.settimeout(SERVER_REPLY_TIMEOUT)
+            chunks: list[bytes] = []
+            while chunk := conn.recv(1 << 16):
+                chunks.append(chunk)
+        reply = json.loads(b"".join(chunks).decode("utf-8"))
+    except (OSError, ValueError) as e:
+        if sent and positional[0] == "save":
+            # The server may already have applied it; running it again would duplicate records.
+            print(f"Error: memo serve did not answer a forwarded save ({e}); check {parsed['db_base']} before retrying", file=sys.stderr)
+            return 1
+        return None
+
+    sys.stdout.write(reply["stdout"])
+    sys.stderr.write(reply["stderr"])
+    return int(reply["rc"])
+
+
+def handle_server_request(payload: bytes) -> dict[str, Any]:
+    out = io.StringIO()
+    err = io.StringIO()
+    rc = 1
+    with redirect_stdout(out), redirect_stderr(err):
+        try:
+            request = json.loads(payload.decode("utf-8"))
+            argv = ["memo", *request["argv"][1:]]
+            parsed, rc = parse_args(argv)
+            if rc == 0 and (parsed["positional"] or [""])[0] not in SERVED_COMMANDS:
+                print("Error: command is not served; run it without the server", file=sys.stderr)
+                rc = 1
+            elif rc == 0:
+                rc = run_command(argv, request["cwd"])
+        except Exception as e:
+            print(f"Error: {e}", file=sys.stderr)
+    return {"rc": rc, "stdout": out.getvalue(), "stderr": err.getvalue()}
+
+
+def command_serve(db_base: str, user_cwd: str, verbose: bool) -> int:
+    global WARM_CACHE, RESULT_CACHE
+    paths = build_db_paths(db_base, user_cwd)
+    if paths.sock.exists():
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as probe:
+                probe.connect(str(paths.sock))
+        except OSError:
+            paths.sock.unlink()
+        else:
+            print(f"Error: a server is already listening on {paths.sock}", file=sys.stderr)
+            return 1
+
+    ensure_parent_dir(paths.sock)
+    WARM_CACHE = {}
+    RESULT_CACHE = ResultCache()
+    PROFILE.startup = None  # requests are answered by a process that is already up
+    try:
+        # Load once up front so the first request is already warm.
+        for shard in shard_paths(paths, load_db_config(paths)):
+            store = open_record_store(shard, verbose)
+            open_metadata_index(shard, store, load_db_config(shard)["indexed_keys"], verbose)
+            open_vector_index(shard, verbose)
+        get_embedder(load_db_config(paths)["embedder"])
+    except Exception as e:
+        print(f"Error: failed to load database '{paths.yaml}': {e}", file=sys.stderr)
+        return 1
+
+    signal.signal(signal.SIGTERM, lambda *_: sys.exit(0))
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        server.bind(str(paths.sock))
+        server.listen(64)
+        print(f"Serving {paths.yaml.name} on {paths.sock}")
+        sys.stdout.flush()
+        while True:
+            conn, _ = server.accept()
+            with conn:
+                conn.settimeout(SERVER_RECV_TIMEOUT)
+                chunks: list[bytes] = []
+                try:
+                    while chunk := conn.recv(1 << 16):
+                        chunks.append(chunk)
+                except OSError as e:
+                    vlog(verbose, f"Dropped a client that did not finish its request: {e}")
+                    continue
+                payload = b"".join(chunks)
+                if not payload:
+                    continue
+                reply = handle_server_request(payload)
+                vlog(verbose, f"Handled request (rc={reply['rc']})")
+                try:
+                    conn.sendall(json.dumps(reply).encode("utf-8"))
+                except OSError:
+                    pass
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.close()
+        paths.sock.unlink(missing_ok=True)
+        WARM_CACHE = None
+        RESULT_CACHE = None
     return 0
 
 
 def print_help() -> None:
     print("Usage:")
     print("  memo --help")
-    print("  memo -f <base> [-v] save <yaml_file>")
-    print("  memo -f <base> [-v] recall [-k <N>] [--filter <expr>] [--yaml] <query>")
-    print("  memo -f <base> [-v] analyze --filter <expr> [--fields <list>] [--stats <key>] [--limit <N>] [--offset <N>]")
-    print("  memo -f <base> [-v] clean")
-    print("  memo -f <base> [-v] reindex")
+    print("  memo -f <base> [-v] [--profile] save <yaml_file|->")
+    print("  memo -f <base> [-v] [--profile] recall [-k <N>] [--filter <expr>] [--mode <mode>] [--yaml|--jsonl] [<tuning>] <query>")
+    print("  memo -f <base> [-v] [--profile] recall [-k <N>] [--filter <expr>] [--mode <mode>] [--yaml|--jsonl] [<tuning>] --batch <file|->")
+    print("  memo -f <base> [-v] [--profile] analyze --filter <expr> [--fields <list>] [--stats <key>] [--limit <N>] [--offset <N>] [--jsonl]")
+    print("  memo -f <base> [-v] [--profile] clean")
+    print("  memo -f <base> [-v] [--profile] reindex [--index <factory>] [--embedder <name>] [--shards <N>] [--shard-key <key>]")
+    print("                                          [--hnsw-m <N>] [--ef-construction <N>] [--ef-search <N>]")
+    print("                                          [--quantize <codec>] [--rerank on|off]")
+    print("  memo -f <base> [-v] [--profile] compact")
+    print("  memo -f <base> [-v] [--profile] serve")
+    print("  memo -f <base> [-v] [--profile] bench [--records <N>] [--cardinality <N>] [--queries <N>] [--batch <N>] [--runs <N>]")
+    print("                                        [--seed <N>] [--out <file>] [--compare <file>] [--keep]")
     print()
     print("Commands:")
     print("  save                Insert/update memory records from YAML input file")
     print("  recall              Semantic recall from <base>.memo + <base>.yaml")
     print("  analyze             Metadata-only reporting from <base>.yaml")
-    print("  clean               Remove <base>.memo and <base>.yaml")
-    print("  reindex             Rebuild <base>.memo from <base>.yaml (full regenerate)")
+    print("  clean               Remove <base>.memo, <base>.yaml and sidecar files")
+    print("  reindex             Rebuild <base>.memo and sidecars from <base>.yaml (full regenerate)")
+    print("  compact             Drop tombstoned (overwritten/deleted) vectors from <base>.memo; ids are kept")
+    print("                      (saves start it in the background past compact_ratio, default 0.2)")
+    print("  serve               Keep <base> loaded and answer save/recall/analyze on <base>.sock")
+    print("  bench               Time save/recall/analyze/reindex and cold startup on a synthetic store in (unused) <base>")
     print()
     print("Options:")
     print("  -f <base>           REQUIRED DB basename")
-    print("  -v                 Verbose logs to stderr")
+    print("                     recall only: repeat -f, or quote a glob (e.g. -f 'stores/*'), to search several")
+    print("                     databases at once; hits are shown as [<base>:<id>] and merged by score")
+    print("                     (vector mode; bases must share an embedder) or by rank (lexical, hybrid)")
+    print("  -v                 Verbose logs to stderr, ending with a per-phase timing/counter summary")
+    print("  --profile          Emit the per-phase timing/counter summary as JSON on stderr")
     print("  <yaml_file>        YAML file for save input (single or multi-doc using ---)")
     print("                     Each doc requires: metadata: <map>, body: <string>")
     print("                     Optional per-doc id: <int> to overwrite existing record")
+    print("                     - reads stdin. JSONL (one record object per line) for .jsonl files, or when")
+    print("                     the first line is a JSON object; YAML for .yaml/.yml files and otherwise")
+    print("                     Input is streamed and saved in batches of 4096 records; on an invalid")
+    print("                     document, batches before it stay saved and the error says how many")
     print("  --filter <expr>    Filter recall results by metadata")
+    print("  --mode <mode>      recall only: vector (default), lexical (BM25 over body tokens via <base>.bm25)")
+    print("                     or hybrid (reciprocal rank fusion of both; scores are RRF sums)")
     print("  --yaml             recall only: emit YAML results with id, score, body")
+    print("  --jsonl            recall/analyze: one JSON object per hit or row on stdout, nothing else")
+    print("                     (recall: query, id, score, body; analyze: the selected fields)")
+    print("  --batch <file|->   recall only: run many queries (JSONL or YAML docs) in one search")
+    print("  <tuning>           recall only: --preset fast|balanced|accurate, --ef <N> (HNSW efSearch),")
+    print("                     --nprobe <N> (IVF lists probed), --overfetch <N> (candidates per k, default 4);")
+    print("                     explicit values override the preset; fast = ef 16, nprobe 4, overfetch 2,")
+    print("                     accurate = ef 256, nprobe 64, overfetch 8, balanced = index defaults")
     print("  --fields <list>    analyze only: comma-separated columns (e.g. id,source,metadata)")
     print("  --stats <key>      analyze only: cardinality + numeric/date-like range for key")
     print("  --limit <N>        analyze only: max rows to print (default: 100)")
     print("  --offset <N>       analyze only: rows to skip before printing (default: 0)")
+    print("  --index <factory>  reindex only: FAISS index_factory string, saved to <base>.conf")
+    print("                     (default: HNSW32,Flat; e.g. HNSW32,SQ8 or IVF4096,PQ48 for large stores)")
+    print("                     Stores under flat_max (default 10000) records use an exact Flat index")
+    print("  --hnsw-m <N>       reindex only: HNSW graph degree M, replacing the M in --index (saved to <base>.conf)")
+    print("  --ef-construction <N>")
+    print("                     reindex only: HNSW build effort (default: 200, saved to <base>.conf)")
+    print("  --ef-search <N>    reindex only: default HNSW query effort stored in the index (default: 64)")
+    print("  --quantize <codec> reindex only: int8 (4x smaller), int4 (8x) or pq (32x) vector codes, or none")
+    print("                     (saved to <base>.conf; stores under flat_max stay exact float)")
+    print("  --rerank on|off    reindex only: re-score quantized hits with float vectors (default: on)")
+    print("  --embedder <name>  reindex only: embedding backend, saved to <base>.conf (default: hash;")
+    print("                     st:<model> runs a local sentence-transformers model, e.g.")
+    print("                     st:sentence-transformers/all-MiniLM-L6-v2; needs memo[st])")
+    print("  --shards <N>       reindex only: split <base> into N shards <base>_s0..; 1 merges them back")
+    print("  --shard-key <key>  reindex only: place records by this metadata key (else by id)")
+    print("  --records <N>      bench only: synthetic records to save (default: 10000)")
+    print("  --cardinality <N>  bench only: distinct source/tag values (default: 16)")
+    print("  --queries <N>      bench only: timed recalls per mode (default: 200)")
+    print("  --batch <N>        bench only: records per timed save (default: 500)")
+    print("  --runs <N>         bench only: timed reindex runs (default: 3)")
+    print("  --out <file>       bench only: JSON results file (default: bench_output.txt)")
+    print("  --compare <file>   bench only: show p50 change against an earlier results file")
+    print("  --keep             bench only: keep the synthetic <base> afterwards")
     print("  --help             Show this help")
 
 
+def expand_db_bases(bases: list[str], user_cwd: str) -> list[str]:
+    # A base with glob characters names every database it matches, found by its
+    # .yaml (or .conf, for sharded stores); shards of a matched store are left out.
+    out: list[str] = []
+    for base in bases:
+        if not glob.has_magic(base):
+            out.append(base)
+            continue
+        stems = {str(Path(match).with_suffix("")) for ext in (".yaml", ".conf") for match in glob.glob(base + ext, root_dir=user_cwd)}
+        stems = {stem for stem in stems if not ((m := re.fullmatch(r"(.*)_s\d+", stem)) and m.group(1) in stems)}
+        if not stems:
+            raise ValueError(f"-f pattern '{base}' matches no database")
+        out.extend(sorted(stems))
+    return list(dict.fromkeys(out))
+
+
 def parse_args(argv: list[str]) -> tuple[dict[str, Any], int]:
-    db_base: str | None = None
+    db_bases: list[str] = []
     verbose = False
+    profile = False
     positional: list[str] = []
 
     i = 1
@@ -736,22 +4190,28 @@ def parse_args(argv: list[str]) -> tuple[dict[str, Any], int]:
             verbose = True
             i += 1
             continue
+        if arg == "--profile":
+            profile = True
+            i += 1
+            continue
         if arg == "-f":
             if i + 1 >= len(argv):
                 print("Error: -f requires a value", file=sys.stderr)
                 return {}, 1
-            db_base = argv[i + 1]
-            if db_base.strip() == "":
+            if argv[i + 1].strip() == "":
                 print("Error: -f requires a non-empty value", file=sys.stderr)
                 return {}, 1
+            db_bases.append(argv[i + 1])
             i += 2
             continue
         positional.append(arg)
         i += 1
 
     return {
-        "db_base": db_base,
+        "db_base": db_bases[0] if db_bases else None,
+        "db_bases": db_bases,
         "verbose": verbose,
+        "profile": profile,
         "positional": positional,
     }, 0
 
@@ -760,11 +4220,41 @@ def parse_recall_args(args: list[str]) -> tuple[dict[str, Any], int]:
     k = 2
     filter_expr: str | None = None
     as_yaml = False
+    batch_path: str | None = None
+    as_jsonl = False
+    preset = "balanced"
+    overrides: dict[str, int] = {}
+    mode = "vector"
     query_parts: list[str] = []
 
     i = 0
     while i < len(args):
         arg = args[i]
+        if arg in ("--ef", "--nprobe", "--overfetch"):
+            try:
+                value = int(args[i + 1]) if i + 1 < len(args) else 0
+            except ValueError:
+                value = 0
+            if value < 1:
+                print(f"Error: {arg} requires a positive integer", file=sys.stderr)
+                return {}, 1
+            overrides[arg[2:]] = value
+            i += 2
+            continue
+        if arg == "--preset":
+            if i + 1 >= len(args) or args[i + 1] not in SEARCH_PRESETS:
+                print(f"Error: --preset must be one of {', '.join(SEARCH_PRESETS)}", file=sys.stderr)
+                return {}, 1
+            preset = args[i + 1]
+            i += 2
+            continue
+        if arg == "--mode":
+            if i + 1 >= len(args) or args[i + 1] not in RECALL_MODES:
+                print(f"Error: --mode must be one of {', '.join(RECALL_MODES)}", file=sys.stderr)
+                return {}, 1
+            mode = args[i + 1]
+            i += 2
+            continue
         if arg == "-k":
             if i + 1 >= len(args):
                 print("Error: -k requires an integer", file=sys.stderr)
@@ -787,20 +4277,159 @@ def parse_recall_args(args: list[str]) -> tuple[dict[str, Any], int]:
             as_yaml = True
             i += 1
             continue
+        if arg == "--jsonl":
+            as_jsonl = True
+            i += 1
+            continue
+        if arg == "--batch":
+            if i + 1 >= len(args):
+                print("Error: --batch requires a file path or -", file=sys.stderr)
+                return {}, 1
+            batch_path = args[i + 1]
+            i += 2
+            continue
         query_parts.append(arg)
         i += 1
 
     query = " ".join(query_parts).strip()
-    if not query:
+    if batch_path is not None and query:
+        print("Error: recall --batch does not accept a <query>", file=sys.stderr)
+        return {}, 1
+    if batch_path is None and not query:
         print("Error: recall requires <query>", file=sys.stderr)
         return {}, 1
+    if as_yaml and as_jsonl:
+        print("Error: --yaml and --jsonl are mutually exclusive", file=sys.stderr)
+        return {}, 1
+
+    return {
+        "k": clamp_k(k),
+        "filter_expr": filter_expr,
+        "as_yaml": as_yaml,
+        "as_jsonl": as_jsonl,
+        "query": query,
+        "batch_path": batch_path,
+        "tuning": replace(SEARCH_PRESETS[preset], **overrides),
+        "mode": mode,
+    }, 0
+
+
+def parse_reindex_args(args: list[str]) -> tuple[dict[str, Any], int]:
+    conf_updates: dict[str, Any] = {}
+    shards: int | None = None
+    shard_key: str | None = None
+
+    i = 0
+    while i < len(args):
+        arg = args[i]
+        if arg == "--index":
+            if i + 1 >= len(args) or not args[i + 1].strip():
+                print("Error: --index requires an index factory string", file=sys.stderr)
+                return {}, 1
+            conf_updates["index"] = args[i + 1].strip()
+            i += 2
+            continue
+        if arg in ("--hnsw-m", "--ef-construction", "--ef-search"):
+            try:
+                value = int(args[i + 1]) if i + 1 < len(args) else 0
+            except ValueError:
+                value = 0
+            if value < (2 if arg == "--hnsw-m" else 1):
+                print(f"Error: {arg} requires a positive integer", file=sys.stderr)
+                return {}, 1
+            conf_updates[arg[2:].replace("-", "_")] = value
+            i += 2
+            continue
+        if arg == "--quantize":
+            if i + 1 >= len(args) or args[i + 1] not in (*QUANTIZE_CODECS, "none"):
+                print(f"Error: --quantize must be one of {', '.join(QUANTIZE_CODECS)}, none", file=sys.stderr)
+                return {}, 1
+            conf_updates["quantize"] = None if args[i + 1] == "none" else args[i + 1]
+            i += 2
+            continue
+        if arg == "--rerank":
+            if i + 1 >= len(args) or args[i + 1] not in ("on", "off"):
+                print("Error: --rerank must be on or off", file=sys.stderr)
+                return {}, 1
+            conf_updates["rerank"] = args[i + 1] == "on"
+            i += 2
+            continue
+        if arg == "--embedder":
+            if i + 1 >= len(args) or not args[i + 1].strip():
+                print("Error: --embedder requires 'hash' or 'st:<model>'", file=sys.stderr)
+                return {}, 1
+            conf_updates["embedder"] = args[i + 1].strip()
+            i += 2
+            continue
+        if arg == "--shards":
+            if i + 1 >= len(args):
+                print("Error: --shards requires an integer", file=sys.stderr)
+                return {}, 1
+            try:
+                shards = int(args[i + 1])
+            except ValueError:
+                print("Error: --shards requires an integer", file=sys.stderr)
+                return {}, 1
+            if shards < 1:
+                print("Error: --shards must be >= 1", file=sys.stderr)
+                return {}, 1
+            i += 2
+            continue
+        if arg == "--shard-key":
+            if i + 1 >= len(args) or not args[i + 1].strip():
+                print("Error: --shard-key requires a metadata key", file=sys.stderr)
+                return {}, 1
+            shard_key = args[i + 1].strip()
+            i += 2
+            continue
+
+        print(f"Error: unknown reindex option '{arg}'", file=sys.stderr)
+        return {}, 1
+
+    return {"conf_updates": conf_updates, "shards": shards, "shard_key": shard_key}, 0
+
+
+def parse_bench_args(args: list[str]) -> tuple[BenchOptions | None, int]:
+    opts = BenchOptions()
+    int_options = {
+        "--records": "records",
+        "--cardinality": "cardinality",
+        "--queries": "queries",
+        "--batch": "batch",
+        "--runs": "runs",
+        "--seed": "seed",
+    }
+
+    i = 0
+    while i < len(args):
+        arg = args[i]
+        if arg in int_options:
+            try:
+                value = int(args[i + 1]) if i + 1 < len(args) else None
+            except ValueError:
+                value = None
+            if value is None or (value < 1 and arg != "--seed"):
+                print(f"Error: {arg} requires a positive integer", file=sys.stderr)
+                return None, 1
+            setattr(opts, int_options[arg], value)
+            i += 2
+            continue
+        if arg in ("--out", "--compare"):
+            if i + 1 >= len(args) or not args[i + 1].strip():
+                print(f"Error: {arg} requires a file path", file=sys.stderr)
+                return None, 1
+            setattr(opts, arg[2:], args[i + 1])
+            i += 2
+            continue
+        if arg == "--keep":
+            opts.keep = True
+            i += 1
+            continue
 
-    if k < 1:
-        k = 1
-    if k > MAX_K:
-        k = MAX_K
+        print(f"Error: unknown bench option '{arg}'", file=sys.stderr)
+        return None, 1
 
-    return {"k": k, "filter_expr": filter_expr, "as_yaml": as_yaml, "query": query}, 0
+    return opts, 0
 
 
 def parse_analyze_args(args: list[str]) -> tuple[dict[str, Any], int]:
@@ -809,10 +4438,15 @@ def parse_analyze_args(args: list[str]) -> tuple[dict[str, Any], int]:
     stats_key: str | None = None
     limit = 100
     offset = 0
+    as_jsonl = False
 
     i = 0
     while i < len(args):
         arg = args[i]
+        if arg == "--jsonl":
+            as_jsonl = True
+            i += 1
+            continue
         if arg == "--filter":
             if i + 1 >= len(args):
                 print("Error: --filter requires a filter expression", file=sys.stderr)
@@ -870,6 +4504,9 @@ def parse_analyze_args(args: list[str]) -> tuple[dict[str, Any], int]:
     if filter_expr is None:
         print("Error: analyze requires --filter <expr>", file=sys.stderr)
         return {}, 1
+    if as_jsonl and stats_key is not None:
+        print("Error: --jsonl lists rows; it cannot be combined with --stats", file=sys.stderr)
+        return {}, 1
 
     return {
         "filter_expr": filter_expr,
@@ -877,20 +4514,35 @@ def parse_analyze_args(args: list[str]) -> tuple[dict[str, Any], int]:
         "stats_key": stats_key,
         "limit": limit,
         "offset": offset,
+        "as_jsonl": as_jsonl,
     }, 0
 
 
-def main() -> int:
-    parsed, rc = parse_args(sys.argv)
+def run_command(argv: list[str], user_cwd: str) -> int:
+    parsed, rc = parse_args(argv)
     if rc != 0:
         return rc
 
+    if PROFILE.active:
+        return dispatch_command(parsed, user_cwd)  # nested (bench): counted into the outer profile
+    PROFILE.reset()
+    PROFILE.active = True
+    try:
+        rc = dispatch_command(parsed, user_cwd)
+    finally:
+        PROFILE.active = False
+    positional = parsed["positional"]
+    if (parsed["verbose"] or parsed["profile"]) and positional and parsed["db_base"] is not None:
+        print_profile(PROFILE.report(positional[0], rc), parsed["profile"])
+    return rc
+
+
+def dispatch_command(parsed: dict[str, Any], user_cwd: str) -> int:
     positional = parsed["positional"]
     if not positional or positional[0] in {"--help", "help"}:
         print_help()
         return 0
 
-    user_cwd = os.getcwd()
     command = positional[0]
     db_base = parsed["db_base"]
     if db_base is None:
@@ -898,6 +4550,15 @@ def main() -> int:
         print_help()
         return 1
     verbose = parsed["verbose"]
+    try:
+        db_bases = expand_db_bases(parsed["db_bases"], user_cwd)
+    except ValueError as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
+    if len(db_bases) > 1 and command != "recall":
+        print(f"Error: {command} takes a single -f <base>; only recall accepts several", file=sys.stderr)
+        return 1
+    db_base = db_bases[0]
 
     if command == "clean":
         if len(positional) != 1:
@@ -906,28 +4567,62 @@ def main() -> int:
         return command_clean(db_base, user_cwd)
 
     if command == "reindex":
-        if len(positional) != 1:
-            print("Error: reindex does not accept extra arguments", file=sys.stderr)
-            return 1
-        return command_reindex(db_base, user_cwd, verbose)
+        reindex_args, rc = parse_reindex_args(positional[1:])
+        if rc != 0:
+            return rc
+        return command_reindex(
+            db_base,
+            user_cwd,
+            verbose,
+            reindex_args["conf_updates"],
+            reindex_args["shards"],
+            reindex_args["shard_key"],
+        )
 
     if command == "save":
         if len(positional) != 2:
-            print("Error: save requires exactly one <yaml_file>", file=sys.stderr)
+            print("Error: save requires exactly one <yaml_file> (or - for stdin)", file=sys.stderr)
+            return 1
+        save_path = positional[1] if positional[1] == "-" else str(Path(user_cwd) / positional[1])
+        return command_save(db_base, save_path, user_cwd, verbose)
+
+    if command == "bench":
+        bench_opts, rc = parse_bench_args(positional[1:])
+        if bench_opts is None:
+            return rc
+        return command_bench(db_base, user_cwd, bench_opts)
+
+    if command == "compact":
+        if len(positional) != 1:
+            print("Error: compact does not accept extra arguments", file=sys.stderr)
             return 1
-        return command_save(db_base, positional[1], user_cwd, verbose)
+        return command_compact(db_base, user_cwd, verbose)
+
+    if command == "serve":
+        if len(positional) != 1:
+            print("Error: serve does not accept extra arguments", file=sys.stderr)
+            return 1
+        return command_serve(db_base, user_cwd, verbose)
 
     if command == "recall":
         recall_args, recall_rc = parse_recall_args(positional[1:])
         if recall_rc != 0:
             return recall_rc
         return command_recall(
-            db_base,
+            db_bases,
             recall_args["query"],
             recall_args["k"],
             recall_args["filter_expr"],
             recall_args["as_yaml"],
             user_cwd,
+            batch_path=(
+                str(Path(user_cwd) / recall_args["batch_path"])
+                if recall_args["batch_path"] not in (None, "-")
+                else recall_args["batch_path"]
+            ),
+            tuning=recall_args["tuning"],
+            mode=recall_args["mode"],
+            as_jsonl=recall_args["as_jsonl"],
         )
 
     if command == "analyze":
@@ -942,6 +4637,7 @@ def main() -> int:
             analyze_args["limit"],
             analyze_args["offset"],
             user_cwd,
+            analyze_args["as_jsonl"],
         )
 
     print(f"Error: unknown command '{command}'", file=sys.stderr)
@@ -949,5 +4645,14 @@ def main() -> int:
     return 1
 
 
+def main() -> int:
+    PROFILE.startup = process_age()
+    user_cwd = os.getcwd()
+    forwarded = forward_to_server(sys.argv, user_cwd)
+    if forwarded is not None:
+        return forwarded
+    return run_command(sys.argv, user_cwd)
+
+
 if __name__ == "__main__":
     raise SystemExit(main())